@@ -29,9 +29,14 @@
 #include <sys/mman.h>
 #include <fnmatch.h>
 #include <errno.h>
+#include <sys/time.h>
 #include <pciaccess.h>
 
 #include "radeon_reg.h"
+#include "avivo_pll.h"
+#include "avivo_wm.h"
+#include "avivo_blit.h"
+#include "avivo_vram.h"
 #include "xf86i2c.h"
 
 int debug;
@@ -54,6 +59,21 @@ unsigned int ctrl_region, fb_region;
 unsigned char * volatile ctrl_mem;
 unsigned char * volatile fb_mem;
 
+/* Where radeon_get/radeon_set go: the card, an in-memory register file
+ * loaded from a "regs all" dump (--sim=<file>), or the card with every
+ * access logged to stderr (--record). */
+#define MMIO_HW     0
+#define MMIO_SIM    1
+#define MMIO_RECORD 2
+int mmio_backend = MMIO_HW;
+
+#define SIM_REGS_SIZE 0x10000
+#define SIM_MC_SIZE   0x100
+static unsigned int *sim_regs;
+static unsigned int sim_mc[SIM_MC_SIZE];
+static unsigned int sim_mc_index;
+static struct timeval mmio_start;
+
 static void fatal(char *why)
 {
     fprintf(stderr, why);
@@ -61,14 +81,95 @@ static void fatal(char *why)
     exit(-1);
 }
 
+static void mmio_record(const char *dir, unsigned long offset,
+                        unsigned int value)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    fprintf(stderr, "%10ldus %s %04lx %08x\n",
+            (now.tv_sec - mmio_start.tv_sec) * 1000000 +
+            (now.tv_usec - mmio_start.tv_usec), dir, offset, value);
+}
+
+static void sim_load(const char *file)
+{
+    FILE *f;
+    char line[256];
+    unsigned long offset;
+    unsigned int value;
+
+    sim_regs = calloc(1, SIM_REGS_SIZE);
+    if (sim_regs == NULL)
+        fatal("can't allocate simulated registers\n");
+    /* idle, so that anything waiting on the engine doesn't spin */
+    sim_regs[0x6494 >> 2] = 0x3fffffff;
+
+    f = fopen(file, "r");
+    if (f == NULL)
+        fatal("can't open register dump\n");
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx %x", &offset, &value) == 2 &&
+            offset < SIM_REGS_SIZE)
+            sim_regs[offset >> 2] = value;
+    }
+    fclose(f);
+}
+
+static void sim_set(unsigned long offset, unsigned int value)
+{
+    if (offset == AVIVO_MC_INDEX)
+        sim_mc_index = value;
+    if (offset == AVIVO_MC_DATA) {
+        if ((sim_mc_index & 0xffff) < SIM_MC_SIZE)
+            sim_mc[sim_mc_index & 0xffff] = value;
+    }
+    else if (offset < SIM_REGS_SIZE)
+        sim_regs[offset >> 2] = value;
+}
+
+static unsigned int sim_get(unsigned long offset)
+{
+    if (offset == AVIVO_MC_DATA) {
+        if ((sim_mc_index & 0xffff) < SIM_MC_SIZE)
+            return sim_mc[sim_mc_index & 0xffff];
+        return 0;
+    }
+    if (offset < SIM_REGS_SIZE)
+        return sim_regs[offset >> 2];
+    return 0;
+}
+
+/* last value written to each index register, see radeon_index_select */
+#define INDEX_CACHE_SIZE 4
+static int index_cache_count;
+static unsigned long index_cache_reg[INDEX_CACHE_SIZE];
+static unsigned long index_cache_value[INDEX_CACHE_SIZE];
+
 static void radeon_set(unsigned long offset, const char *name, unsigned int value)
 {
+    int i;
+
     if (debug) 
         printf("writing %s (%lx) -> %08x\n", name, offset, value);
 
+    for (i = 0; i < index_cache_count; i++) {
+        if (index_cache_reg[i] == offset)
+            index_cache_value[i] = value;
+    }
+
+    if (mmio_backend == MMIO_SIM) {
+        sim_set(offset, value);
+        mmio_record("W", offset, value);
+        return;
+    }
+
     if (ctrl_mem == NULL)
         fatal("internal error\n");
 
+    if (mmio_backend == MMIO_RECORD)
+        mmio_record("W", offset, value);
+
 #ifdef __powerpc__
     __asm__ __volatile__ ("stwbrx %1,%2,%3\n\t"
                           "eieio"
@@ -79,11 +180,33 @@ static void radeon_set(unsigned long offset, const char *name, unsigned int valu
 #endif
 }
 
+static void radeon_index_select(unsigned long index_offset,
+                                unsigned long offset)
+{
+    int i;
+
+    for (i = 0; i < index_cache_count; i++) {
+        if (index_cache_reg[i] == index_offset) {
+            if (index_cache_value[i] != offset)
+                radeon_set(index_offset, "index", offset);
+            return;
+        }
+    }
+
+    /* first use of this index register, we don't know where it points */
+    radeon_set(index_offset, "index", offset);
+    if (index_cache_count < INDEX_CACHE_SIZE) {
+        index_cache_reg[index_cache_count] = index_offset;
+        index_cache_value[index_cache_count] = offset;
+        index_cache_count++;
+    }
+}
+
 static void radeon_set_indexed(unsigned long index_offset,
                                unsigned long data_offset, unsigned long offset,
                                const char *name, unsigned int value)
 {
-    radeon_set(index_offset, "index", offset);
+    radeon_index_select(index_offset, offset);
     radeon_set(data_offset, name, value);
 }
 
@@ -94,6 +217,14 @@ static unsigned int radeon_get(unsigned long offset, const char *name)
     if (debug) 
         printf("reading %s (%lx) is ", name, offset);
 
+    if (mmio_backend == MMIO_SIM) {
+        value = sim_get(offset);
+        mmio_record("R", offset, value);
+        if (debug)
+            printf("%08x\n", value);
+        return value;
+    }
+
     if (ctrl_mem == NULL)
         fatal("internal error\n");
 
@@ -107,6 +238,9 @@ static unsigned int radeon_get(unsigned long offset, const char *name)
     value = *(unsigned int * volatile)(ctrl_mem + offset);
 #endif
 
+    if (mmio_backend == MMIO_RECORD)
+        mmio_record("R", offset, value);
+
     if (debug) 
         printf("%08x\n", value);
 
@@ -117,7 +251,7 @@ static unsigned int radeon_get_indexed(unsigned long index_offset,
                                        unsigned long data_offset,
                                        unsigned long offset, const char *name)
 {
-    radeon_set(index_offset, "index", offset);
+    radeon_index_select(index_offset, offset);
     return radeon_get(data_offset, name);
 }
 
@@ -134,14 +268,35 @@ static void radeon_set_mc(unsigned long offset, const char *name,
                               offset | 0x00ff0000, name, value);
 }
 
+/* read count consecutive MC registers starting at offset */
+static void radeon_get_mc_range(unsigned long offset, int count,
+                                unsigned int *values)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        values[i] = radeon_get_mc(offset + i, "MC range");
+}
+
 static void usage(void)
 {
     printf("usage: avivotool [options] [command]\n");
     printf("         --debug            - show a little debug info\n");
     printf("         --skip=1           - use the second radeon card\n");
+    printf("         --sim=<dump>       - don't touch the card, use registers\n");
+    printf("                              from a 'regs all' dump instead\n");
+    printf("         --record           - log every register access to stderr\n");
+    printf("         pll <kHz>          - show the PLL dividers for a pixel clock\n");
+    printf("         pllbench           - time the PLL solver from 25 to 400 MHz\n");
+    printf("         wmcheck            - run the watermark calculator test table\n");
+    printf("         shadowbench        - time the shadow copies and threads into memory\n");
+    printf("         vramcheck          - run the VRAM heap test table\n");
+    printf("         vramwindow         - check MM_INDEX/MM_DATA against the BAR mapping\n");
+    printf("         flipcheck <crtc>   - check that flips on crtc 0 or 1 latch in vblank\n");
     printf("         regs <set>         - show a listing of some random registers\n");
     printf("                              <set> restricts: all, core, mc, crtc1, cur1\n");
     printf("         regmatch <pattern> - show registers matching wildcard pattern\n");
+    printf("         regmatch MC:<a>-<b> - show MC registers a to b\n");
     printf("         regset <pattern> <value> - set registers matching wildcard pattern\n");
     printf("         romtables <path>   - dumps the BIOS tables from either a given path\n");
     printf("                              or 'mmap' to get it from memory\n");
@@ -601,6 +756,8 @@ int radeon_get_fb_params(char *crtc, int write, unsigned long *location, int *le
         return 0;
     }
 
+    if (avivo_device == NULL)
+        return 0;
     *location -= avivo_device->regions[fb_region].base_addr;
     *location += (unsigned long) fb_mem;
 
@@ -1233,9 +1390,10 @@ void radeon_cmd_regs(const char *type)
 
 void radeon_reg_match(const char *pattern)
 {
-    int i;
+    int i, count;
     unsigned long address;
-    unsigned int value;
+    unsigned int value, *values;
+    char *end;
 
     if (pattern[0] == '0' && pattern[1] == 'x') {
         address = strtol(&(pattern[2]), NULL, 16);
@@ -1243,9 +1401,25 @@ void radeon_reg_match(const char *pattern)
         printf("%s\t0x%08x (%d)\n", pattern, value, value);
     }
     else if (pattern[0] == 'M' && pattern[1] == 'C' && pattern[2] == ':') {
-        address = strtol(&(pattern[3]), NULL, 16);
-        value = radeon_get_mc(address, pattern);
-        printf("%s\t0x%08x (%d)\n", pattern, value, value);
+        address = strtol(&(pattern[3]), &end, 16);
+        if (*end == '-') {
+            /* MC:start-end, inclusive */
+            count = strtol(end + 1, NULL, 16) - address + 1;
+            if (count <= 0 || count > 0x10000)
+                fatal("bad MC register range\n");
+            values = malloc(count * sizeof(*values));
+            if (values == NULL)
+                fatal("can't allocate MC range\n");
+            radeon_get_mc_range(address, count, values);
+            for (i = 0; i < count; i++)
+                printf("MC:%04lx\t0x%08x (%d)\n", address + i,
+                       values[i], values[i]);
+            free(values);
+        }
+        else {
+            value = radeon_get_mc(address, pattern);
+            printf("%s\t0x%08x (%d)\n", pattern, value, value);
+        }
     }
     else {
         for (i = 0; i < sizeof(reg_list) / sizeof(reg_list[0]); i++) {
@@ -1787,11 +1961,503 @@ void radeon_rom_tables(const char * file)
     }
 }
 
+static double elapsed_usec(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1e6 +
+           (now.tv_usec - start->tv_usec);
+}
+
+/* show the dividers the driver would pick for a pixel clock */
+void radeon_cmd_pll(const char *arg)
+{
+    struct avivo_pll pll;
+    int clock = atoi(arg), ok, table;
+
+    if (clock <= 0)
+        fatal("pixel clock must be given in kHz\n");
+    table = avivo_pll_table_find(clock, &pll);
+    if (table)
+        ok = pll.ppm <= AVIVO_PLL_MAX_PPM;
+    else
+        ok = avivo_pll_solve(clock, &pll);
+
+    printf("target\t%d kHz (%s)\n", clock, table ? "table" : "solved");
+    printf("clock\t%d kHz, %d ppm%s\n", pll.clock, pll.ppm,
+           ok ? "" : ", out of tolerance");
+    printf("post_div\t%d\n", pll.post_div);
+    printf("post_mul\t%d (0x%x)\n", pll.mul, pll.mul);
+    printf("divider\t%d\n", pll.div);
+}
+
+/* time the PLL solver over every clock from 25 to 400 MHz */
+void radeon_cmd_pll_bench(void)
+{
+    struct avivo_pll_cache cache;
+    struct avivo_pll pll;
+    struct timeval start;
+    int clock, count = 0, reachable = 0, max_ppm = 0, max_clock = 0;
+    double usec;
+
+    gettimeofday(&start, NULL);
+    for (clock = 25000; clock <= 400000; clock++) {
+        count++;
+        if (avivo_pll_solve(clock, &pll)) {
+            reachable++;
+            max_clock = clock;
+            if (pll.ppm > max_ppm)
+                max_ppm = pll.ppm;
+        }
+    }
+    usec = elapsed_usec(&start);
+    printf("solve:  %d clocks in %.0f us, %.3f us per clock\n",
+           count, usec, usec / count);
+    printf("        %d within %d ppm, worst %d ppm, highest %d kHz\n",
+           reachable, AVIVO_PLL_MAX_PPM, max_ppm, max_clock);
+
+    /* the same few clocks over and over, like mode sets do */
+    memset(&cache, 0, sizeof(cache));
+    gettimeofday(&start, NULL);
+    for (clock = 0; clock < count; clock++)
+        avivo_pll_cache_get(&cache, 25000 + (clock % 8) * 25000, &pll);
+    usec = elapsed_usec(&start);
+    printf("cached: %d lookups in %.0f us, %.3f us per lookup "
+           "(%lu hits, %lu misses)\n",
+           count, usec, usec / count, cache.hits, cache.misses);
+}
+
+/*
+ * Known answers for avivo_wm_compute(): mclk, both heads as
+ * { clock, hdisplay, htotal, cpp }, then fits, lb split and priorities.
+ */
+static const struct {
+    struct avivo_wm_params params;
+    int fits;
+    unsigned int lb_split;
+    unsigned int priority[2];
+} wm_tests[] = {
+    /* 640x480 alone, slow memory */
+    { { 200000, 0, { { 25175, 640, 800, 4 }, { 0, 0, 0, 0 } } },
+      1, AVIVO_DC_LB_MEMORY_SPLIT_D1_ONLY, { 0x3, AVIVO_CRTC_PRIORITY_OFF } },
+    /* 1280x1024 16bpp on the second crtc only */
+    { { 0, 0, { { 0, 0, 0, 0 }, { 108000, 1280, 1688, 2 } } },
+      1, AVIVO_DC_LB_MEMORY_SPLIT_D1_1Q_D2_3Q,
+      { AVIVO_CRTC_PRIORITY_OFF, 0x7 } },
+    /* 1920x1200 next to 1024x768 */
+    { { 400000, 0, { { 154000, 1920, 2080, 4 }, { 65000, 1024, 1344, 4 } } },
+      1, AVIVO_DC_LB_MEMORY_SPLIT_D1HALF_D2HALF, { 0xb, 0x5 } },
+    /* two 1920x1200, half the memory busy */
+    { { 200000, 0, { { 154000, 1920, 2080, 4 }, { 154000, 1920, 2080, 4 } } },
+      1, AVIVO_DC_LB_MEMORY_SPLIT_D1HALF_D2HALF, { 0x14, 0x14 } },
+    /* two 2560x1600 */
+    { { 400000, 0, { { 268500, 2560, 2720, 4 }, { 268500, 2560, 2720, 4 } } },
+      1, AVIVO_DC_LB_MEMORY_SPLIT_D1HALF_D2HALF, { 0x1a, 0x1a } },
+    /* two 2560x1600 on memory that can't keep up */
+    { { 100000, 0, { { 268500, 2560, 2720, 4 }, { 268500, 2560, 2720, 4 } } },
+      0, AVIVO_DC_LB_MEMORY_SPLIT_D1HALF_D2HALF,
+      { AVIVO_CRTC_PRIORITY_ALWAYS_ON | 0x15,
+        AVIVO_CRTC_PRIORITY_ALWAYS_ON | 0x15 } },
+};
+
+/* run avivo_wm_compute() over the known answers */
+int radeon_cmd_wm_check(void)
+{
+    struct avivo_wm wm;
+    unsigned int b;
+    int i, h, fits, failed = 0;
+
+    for (i = 0; i < sizeof(wm_tests) / sizeof(wm_tests[0]); i++) {
+        fits = avivo_wm_compute(&wm_tests[i].params, &wm);
+        printf("%d: fits %d, lb split %u, priority 0x%x 0x%x, "
+               "%d of %d kB/s", i, fits, wm.lb_split, wm.priority[0],
+               wm.priority[1], wm.demand, wm.available);
+        /* set B is set A kept urgent, or off with it */
+        for (h = 0; h < 2; h++) {
+            b = wm.priority[h];
+            if (!(b & AVIVO_CRTC_PRIORITY_OFF))
+                b |= AVIVO_CRTC_PRIORITY_ALWAYS_ON;
+            if (wm.priority_b[h] != b) {
+                printf(" FAILED (head %d priority B 0x%x, want 0x%x)",
+                       h, wm.priority_b[h], b);
+                failed++;
+            }
+        }
+        if (fits != wm_tests[i].fits ||
+            wm.lb_split != wm_tests[i].lb_split ||
+            wm.priority[0] != wm_tests[i].priority[0] ||
+            wm.priority[1] != wm_tests[i].priority[1]) {
+            printf(" FAILED (want fits %d, lb split %u, priority 0x%x 0x%x)",
+                   wm_tests[i].fits, wm_tests[i].lb_split,
+                   wm_tests[i].priority[0], wm_tests[i].priority[1]);
+            failed++;
+        }
+        printf("\n");
+    }
+    return failed;
+}
+
+/*
+ * Known answers for the VRAM heap, on one from 0x1800 (rounded up to
+ * 0x2000) to 0x10000: 'a'llocate size/align or 'f'ree an offset, and
+ * the offset (0 if it must fail) or free result wanted.
+ */
+static const struct {
+    char op;
+    unsigned long arg, align, want;
+} vram_tests[] = {
+    { 'a', 0x1000, 0,      0x2000 },
+    { 'a', 0x1001, 0,      0x3000 },    /* rounded up to two pages */
+    { 'a', 0x1000, 0x4000, 0x8000 },
+    { 'f', 0x3000, 0,      1 },
+    { 'a', 0x1000, 0,      0x3000 },    /* first fit reuses the hole */
+    { 'a', 0x3000, 0,      0x4000 },
+    { 'a', 0x8000, 0,      0 },         /* only 0x7000 left at the end */
+    { 'a', 0x7000, 0,      0x9000 },
+    { 'a', 0x2000, 0,      0 },         /* one page left, at 0x7000 */
+    { 'a', 0x1000, 0,      0x7000 },
+    { 'a', 0x1000, 0,      0 },         /* full */
+    { 'f', 0x5000, 0,      0 },         /* not a block start */
+    { 'f', 0x2000, 0,      1 },
+    { 'a', 0x1000, 0,      0x2000 },
+};
+
+/* run the VRAM heap over the known answers */
+int radeon_cmd_vram_check(void)
+{
+    struct avivo_vram_heap heap;
+    unsigned long got;
+    int i, failed = 0;
+
+    avivo_vram_heap_init(&heap, 0x1800, 0x10000);
+    for (i = 0; i < sizeof(vram_tests) / sizeof(vram_tests[0]); i++) {
+        if (vram_tests[i].op == 'a') {
+            got = avivo_vram_heap_alloc(&heap, vram_tests[i].arg,
+                                        vram_tests[i].align);
+            printf("%2d: alloc 0x%lx align 0x%lx -> 0x%lx", i,
+                   vram_tests[i].arg, vram_tests[i].align, got);
+        } else {
+            got = avivo_vram_heap_free(&heap, vram_tests[i].arg);
+            printf("%2d: free 0x%lx -> %lu", i, vram_tests[i].arg, got);
+        }
+        if (got != vram_tests[i].want) {
+            printf(" FAILED (want 0x%lx)", vram_tests[i].want);
+            failed++;
+        }
+        printf("\n");
+    }
+    printf("%d blocks in use, %lu allocations, %lu failed\n",
+           heap.count, heap.allocs, heap.failures);
+    return failed;
+}
+
+#define VRAM_WINDOW_DWORDS  1024
+
+/*
+ * The driver copies VRAM past the BAR through MM_INDEX/MM_DATA with
+ * RADEON_MM_APER set.  Check that on the last page the BAR maps:
+ * read it through the window and the mapping and compare, then write
+ * a pattern through the window and read it back through the mapping.
+ * The page is restored afterwards.
+ */
+int radeon_cmd_vram_window(void)
+{
+    volatile unsigned int *page;
+    unsigned int saved[VRAM_WINDOW_DWORDS], v;
+    unsigned long offset;
+    int i, failed = 0;
+
+    if (fb_mem == NULL) {
+        printf("no frame buffer mapping\n");
+        return 1;
+    }
+    offset = avivo_device->regions[fb_region].size - VRAM_WINDOW_DWORDS * 4;
+    page = (volatile unsigned int *)(fb_mem + offset);
+    printf("checking 0x%08lx\n", offset);
+
+    for (i = 0; i < VRAM_WINDOW_DWORDS; i++) {
+        saved[i] = page[i];
+        SET_REG(RADEON_MM_INDEX, (offset + i * 4) | RADEON_MM_APER);
+        v = GET_REG(RADEON_MM_DATA);
+        if (v != saved[i] && failed++ < 8)
+            printf("read 0x%08lx: window 0x%08x, BAR 0x%08x FAILED\n",
+                   offset + i * 4, v, saved[i]);
+    }
+    for (i = 0; i < VRAM_WINDOW_DWORDS; i++) {
+        SET_REG(RADEON_MM_INDEX, (offset + i * 4) | RADEON_MM_APER);
+        SET_REG(RADEON_MM_DATA, 0x5a000000 ^ (i * 0x01010101));
+    }
+    for (i = 0; i < VRAM_WINDOW_DWORDS; i++) {
+        v = page[i];
+        if (v != (0x5a000000 ^ (i * 0x01010101)) && failed++ < 8)
+            printf("write 0x%08lx: BAR 0x%08x, wrote 0x%08x FAILED\n",
+                   offset + i * 4, v, 0x5a000000 ^ (i * 0x01010101));
+        page[i] = saved[i];
+    }
+    printf("%d dwords, %d mismatches\n", VRAM_WINDOW_DWORDS, failed);
+    return failed;
+}
+
+/* a 2560x1600 screen at 32 bpp, padded like avivo_screen_init() does */
+#define BENCH_WIDTH     2560
+#define BENCH_HEIGHT    1600
+#define BENCH_CPP       4
+#define BENCH_PITCH     (((BENCH_WIDTH + 255) & ~255) * BENCH_CPP)
+
+static const struct {
+    const char *name;
+    int size;       /* box side, 0 for the whole screen */
+    int x_skew;     /* unaligned left edge */
+} shadow_bench_cases[] = {
+    { "full screen", 0, 0 },
+    { "256x256 boxes", 256, 0 },
+    { "64x64 boxes", 64, 0 },
+    { "61x61 boxes, odd x", 61, 3 },
+};
+
+/*
+ * Copy boxes from a shadow to a fake VRAM in plain memory with each
+ * copy the CPU has, check the result and report the throughput.  Real
+ * VRAM is write combined and behind PCIe, expect it lower.
+ */
+int radeon_cmd_shadow_bench(void)
+{
+    static const char *names[] = { "c", "sse2", "avx2" };
+    const struct avivo_blit *blit;
+    unsigned char *shadow, *vram;
+    unsigned long bytes;
+    struct timeval start;
+    double usec;
+    int i, c, n, x, y, size, rounds, failed = 0;
+
+    if (posix_memalign((void **)&shadow, 4096, BENCH_PITCH * BENCH_HEIGHT) ||
+        posix_memalign((void **)&vram, 4096, BENCH_PITCH * BENCH_HEIGHT)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < BENCH_PITCH * BENCH_HEIGHT; i++)
+        shadow[i] = i * 7 + (i >> 12);
+
+    for (n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        blit = avivo_blit_find(names[n]);
+        if (blit == NULL) {
+            printf("%-5s not supported\n", names[n]);
+            continue;
+        }
+        for (c = 0; c < sizeof(shadow_bench_cases) /
+                        sizeof(shadow_bench_cases[0]); c++) {
+            size = shadow_bench_cases[c].size;
+            memset(vram, 0, BENCH_PITCH * BENCH_HEIGHT);
+            bytes = 0;
+            rounds = 0;
+            gettimeofday(&start, NULL);
+            do {
+                if (!size)
+                    bytes += avivo_blit_box(blit, vram, shadow, BENCH_PITCH,
+                                            BENCH_CPP, 0, 0, BENCH_WIDTH,
+                                            BENCH_HEIGHT);
+                for (y = 0; size && y + size <= BENCH_HEIGHT; y += size)
+                    for (x = shadow_bench_cases[c].x_skew;
+                         x + size <= BENCH_WIDTH; x += size)
+                        bytes += avivo_blit_box(blit, vram, shadow,
+                                                BENCH_PITCH, BENCH_CPP, x, y,
+                                                x + size, y + size);
+                rounds++;
+                usec = elapsed_usec(&start);
+            } while (usec < 500000);
+            printf("%-5s %-20s %6.0f MB/s, %.0f us per screen\n",
+                   blit->name, shadow_bench_cases[c].name, bytes / usec,
+                   usec / rounds);
+            /* every pixel of the boxes made it, and nothing outside */
+            for (y = 0; y < BENCH_HEIGHT; y++) {
+                int x1 = size ? shadow_bench_cases[c].x_skew : 0;
+                int x2 = size ? x1 + (BENCH_WIDTH - x1) / size * size
+                              : BENCH_WIDTH;
+                int y2 = size ? BENCH_HEIGHT / size * size : BENCH_HEIGHT;
+
+                if (y < y2 && memcmp(vram + y * BENCH_PITCH + x1 * BENCH_CPP,
+                                     shadow + y * BENCH_PITCH + x1 * BENCH_CPP,
+                                     (x2 - x1) * BENCH_CPP)) {
+                    printf("      line %d differs: FAILED\n", y);
+                    failed++;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* tile hashes, and every variant agrees on them */
+    for (n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        unsigned long long hash, want = 0;
+        int tiles;
+
+        blit = avivo_blit_find(names[n]);
+        if (blit == NULL)
+            continue;
+        tiles = 0;
+        gettimeofday(&start, NULL);
+        do {
+            for (y = 0; y + 64 <= BENCH_HEIGHT; y += 64)
+                for (x = 0; x + 64 <= BENCH_WIDTH; x += 64, tiles++)
+                    hash = blit->hash(shadow + y * BENCH_PITCH + x * BENCH_CPP,
+                                      BENCH_PITCH, 64 * BENCH_CPP, 64);
+            usec = elapsed_usec(&start);
+        } while (usec < 500000);
+        printf("%-5s %-20s %6.0f MB/s, %.2f us per tile\n", blit->name,
+               "64x64 tile hash", tiles * 64.0 * 64 * BENCH_CPP / usec,
+               usec / tiles);
+        /* an odd width takes the tail path */
+        hash = blit->hash(shadow + 12, BENCH_PITCH, 61 * BENCH_CPP, 64);
+        want = avivo_blit_find("c")->hash(shadow + 12, BENCH_PITCH,
+                                          61 * BENCH_CPP, 64);
+        if (hash != want) {
+            printf("      hash %016llx, want %016llx: FAILED\n", hash, want);
+            failed++;
+        }
+    }
+
+    /* full screen flushes over the pool, as the driver runs them */
+    blit = avivo_blit_find(NULL);
+    for (n = 1; n <= AVIVO_BLIT_MAX_THREADS; n++) {
+        struct avivo_blit_pool pool;
+        struct avivo_blit_job job;
+        short box[4] = { 0, 0, BENCH_WIDTH, BENCH_HEIGHT };
+        int threads, banded;
+
+        threads = avivo_blit_pool_init(&pool, n);
+        job.blit = blit;
+        job.dst = vram;
+        job.src = shadow;
+        job.pitch = BENCH_PITCH;
+        job.cpp = BENCH_CPP;
+        job.boxes = box;
+        job.nbox = 1;
+        memset(vram, 0, BENCH_PITCH * BENCH_HEIGHT);
+        bytes = 0;
+        rounds = 0;
+        gettimeofday(&start, NULL);
+        do {
+            bytes += avivo_blit_run(&pool, &job, &banded);
+            rounds++;
+            usec = elapsed_usec(&start);
+        } while (usec < 500000);
+        avivo_blit_pool_fini(&pool);
+        printf("%-5s %d thread%s %12s %6.0f MB/s, %.0f us per screen\n",
+               blit->name, threads, threads > 1 ? "s" : " ", "",
+               bytes / usec, usec / rounds);
+        if (memcmp(vram, shadow, BENCH_PITCH * BENCH_HEIGHT)) {
+            printf("      screen differs: FAILED\n");
+            failed++;
+        }
+    }
+
+    free(shadow);
+    free(vram);
+    return failed;
+}
+
+#define FLIP_CHECK_ROUNDS   20
+/* no crtc runs slower than 10 Hz */
+#define FLIP_CHECK_TIMEOUT  100000
+
+/*
+ * Re-flip a crtc onto the buffer it already scans out, the way the
+ * driver's avivo_crtc_flip() does, and check where the chip latches
+ * it: the pending bit has to clear on a line inside vblank, as
+ * programmed in V_BLANK (blank start low, blank end high).  The screen
+ * doesn't change.  A chip that never raises the pending bit for an
+ * unchanged address can't be checked this way, those rounds are
+ * skipped.
+ */
+int radeon_cmd_flip_check(const char *arg)
+{
+    unsigned long offset = 0;
+    unsigned int location, end, v_blank, update;
+    int blank_start, blank_end, before, line, i;
+    int seen, failed = 0, skipped = 0;
+    unsigned int frame, frame_before;
+    struct timeval start;
+
+    if (atoi(arg))
+        offset = AVIVO_CRTC2_H_TOTAL - AVIVO_CRTC1_H_TOTAL;
+    if (!(GET_REG(AVIVO_CRTC1_CNTL + offset) & AVIVO_CRTC_EN)) {
+        printf("crtc %s is off\n", arg);
+        return 1;
+    }
+    location = GET_REG(AVIVO_CRTC1_FB_LOCATION + offset);
+    end = GET_REG(AVIVO_CRTC1_FB_END + offset);
+    v_blank = GET_REG(AVIVO_CRTC1_V_BLANK + offset);
+    blank_start = v_blank & 0xffff;
+    blank_end = (v_blank >> 16) & 0xffff;
+    printf("crtc %s: vblank from line %d to %d, flipping to 0x%08x\n",
+           arg, blank_start, blank_end, location);
+
+    for (i = 0; i < FLIP_CHECK_ROUNDS; i++) {
+        frame_before = GET_REG(AVIVO_CRTC1_STATUS_FRAME_COUNT + offset);
+        SET_REG(AVIVO_CRTC1_GRPH_UPDATE + offset, AVIVO_CRTC_GRPH_UPDATE_LOCK);
+        SET_REG(AVIVO_CRTC1_FB_LOCATION + offset, location);
+        SET_REG(AVIVO_CRTC1_FB_END + offset, end);
+        SET_REG(AVIVO_CRTC1_GRPH_UPDATE + offset, 0);
+
+        seen = 0;
+        before = line = -1;
+        gettimeofday(&start, NULL);
+        do {
+            update = GET_REG(AVIVO_CRTC1_GRPH_UPDATE + offset);
+            before = line;
+            line = GET_REG(AVIVO_CRTC1_STATUS_POSITION + offset) &
+                   AVIVO_CRTC_V_POSITION_MASK;
+            if (!(update & AVIVO_CRTC_GRPH_SURFACE_UPDATE_PENDING))
+                break;
+            seen = 1;
+        } while (elapsed_usec(&start) < FLIP_CHECK_TIMEOUT);
+        frame = GET_REG(AVIVO_CRTC1_STATUS_FRAME_COUNT + offset);
+
+        printf("%2d: ", i);
+        if (update & AVIVO_CRTC_GRPH_SURFACE_UPDATE_PENDING) {
+            printf("still pending after %d us FAILED\n", FLIP_CHECK_TIMEOUT);
+            failed++;
+        } else if (!seen) {
+            printf("pending never set, skipped\n");
+            skipped++;
+        } else if (line < blank_start && line >= blank_end) {
+            printf("latched on active line %d (before %d) FAILED\n",
+                   line, before);
+            failed++;
+        } else {
+            printf("latched on line %d (before %d), frame +%u\n",
+                   line, before, frame - frame_before);
+        }
+        /* start the next round somewhere else in the frame */
+        usleep(3000 + 1000 * i);
+    }
+    printf("%d flips, %d failed, %d skipped\n", FLIP_CHECK_ROUNDS, failed,
+           skipped);
+    return failed;
+}
+
 int main(int argc, char *argv[]) 
 {
     if (argc == 1)
         usage();
 
+    /* no hardware needed */
+    if (strcmp(argv[1], "pllbench") == 0) {
+        radeon_cmd_pll_bench();
+        return 0;
+    }
+    if (strcmp(argv[1], "wmcheck") == 0)
+        return radeon_cmd_wm_check() ? 1 : 0;
+    if (strcmp(argv[1], "shadowbench") == 0)
+        return radeon_cmd_shadow_bench() ? 1 : 0;
+    if (strcmp(argv[1], "vramcheck") == 0)
+        return radeon_cmd_vram_check() ? 1 : 0;
+    if (strcmp(argv[1], "pll") == 0 && argc == 3) {
+        radeon_cmd_pll(argv[2]);
+        return 0;
+    }
+
     if (strcmp(argv[1], "--debug") == 0) {
         debug = 1;
         argv++;
@@ -1804,7 +2470,21 @@ int main(int argc, char *argv[])
         argc--;
     }
 
-    map_radeon_mem();
+    if (strncmp(argv[1], "--sim=", 6) == 0) {
+        mmio_backend = MMIO_SIM;
+        sim_load(argv[1] + 6);
+        argv++;
+        argc--;
+    }
+    else if (strcmp(argv[1], "--record") == 0) {
+        mmio_backend = MMIO_RECORD;
+        argv++;
+        argc--;
+    }
+    gettimeofday(&mmio_start, NULL);
+
+    if (mmio_backend != MMIO_SIM)
+        map_radeon_mem();
 
     if (argc == 2) {
         if (strcmp(argv[1], "regs") == 0) {
@@ -1815,6 +2495,8 @@ int main(int argc, char *argv[])
             radeon_i2c();
             return 0;
         }
+        if (strcmp(argv[1], "vramwindow") == 0)
+            return radeon_cmd_vram_window() ? 1 : 0;
         if (strcmp(argv[1], "i2c-monitor") == 0) {
             radeon_i2c_monitor_default();
             return 0;
@@ -1841,6 +2523,8 @@ int main(int argc, char *argv[])
             radeon_load_img(argv[2]);
             return 0;
         }
+        else if (strcmp(argv[1], "flipcheck") == 0)
+            return radeon_cmd_flip_check(argv[2]) ? 1 : 0;
     }
     else if (argc == 4) {
         if (strcmp(argv[1], "regset") == 0) {
@@ -35,6 +35,10 @@
 #include "fb.h"
 
 #include "avivo_chipset.h"
+#include "avivo_pll.h"
+#include "avivo_wm.h"
+#include "avivo_blit.h"
+#include "avivo_vram.h"
 
 #ifdef PCIACCESS
 #include <pciaccess.h>
@@ -49,8 +53,267 @@
 
 #define RADEON_VBIOS_SIZE 0x00010000
 
-#define INREG(x) MMIO_IN32(avivo->ctrl_base, x)
-#define OUTREG(x, y) MMIO_OUT32(avivo->ctrl_base, x, y)
+#define INREG(x) avivo_mmio_in(avivo, x)
+#define OUTREG(x, y) avivo_mmio_out(avivo, x, y)
+#define QOUTREG(x, y) avivo_queue_reg(avivo, x, y)
+
+/*
+ * Enough for full mode sets on both crtcs, PLLs included, with room to
+ * spare.  Whatever still doesn't fit fails the flush, see
+ * avivo_queue_reg().
+ */
+#define AVIVO_REG_QUEUE_SIZE 256
+
+struct avivo_reg_queue {
+    Bool              active;
+    Bool              wait_idle;
+    Bool              overflow;
+    int               count;
+    struct {
+        unsigned int  reg;
+        unsigned int  value;
+    } writes[AVIVO_REG_QUEUE_SIZE];
+};
+
+/*
+ * Last value written to each index register we use, so that repeated
+ * accesses through the same index/data pair skip the index write.
+ */
+#define AVIVO_INDEX_CACHE_SIZE 4
+
+struct avivo_index_cache {
+    int               count;
+    unsigned int      index_reg[AVIVO_INDEX_CACHE_SIZE];
+    unsigned int      value[AVIVO_INDEX_CACHE_SIZE];
+    Bool              valid[AVIVO_INDEX_CACHE_SIZE];
+    unsigned long     writes_avoided;
+};
+
+/*
+ * Idle wait, see avivo_wait_idle().  The chip is polled for
+ * AVIVO_IDLE_SPINS reads, then we sleep with a doubling interval capped
+ * at AVIVO_IDLE_MAX_SLEEP us until timeout_usec has passed.
+ */
+#define AVIVO_IDLE_SPINS 64
+#define AVIVO_IDLE_MIN_SLEEP 10
+#define AVIVO_IDLE_MAX_SLEEP 1000
+#define AVIVO_IDLE_TIMEOUT 100 /* ms */
+
+struct avivo_idle {
+    unsigned long     timeout_usec;
+    unsigned long     waits;
+    unsigned long     sleeps;
+    unsigned long     timeouts;
+    unsigned long     total_usec;
+    unsigned long     max_usec;
+};
+
+/*
+ * Where INREG/OUTREG end up: the real chip, an in-memory register file
+ * or the real chip with every access logged.  The simulated file and
+ * the recorder both keep a trace of accesses, see avivo_mmio.c.
+ */
+enum avivo_mmio_backend {
+    AVIVO_MMIO_HW = 0,
+    AVIVO_MMIO_SIM,
+    AVIVO_MMIO_RECORD
+};
+
+#define AVIVO_MMIO_SIM_SIZE 0x10000
+#define AVIVO_MMIO_TRACE_SIZE 4096
+
+struct avivo_mmio_trace {
+    unsigned long     usec;
+    unsigned int      reg;
+    unsigned int      value;
+    Bool              write;
+};
+
+/*
+ * Optional per-register access counters (Option "MMIOStats").  Reads
+ * are timed and binned in a log2 histogram of nanoseconds: bucket n
+ * holds reads that took [2^n, 2^(n+1)) ns.
+ */
+#define AVIVO_MMIO_STATS_REGS (AVIVO_MMIO_SIM_SIZE >> 2)
+#define AVIVO_MMIO_HIST_SIZE 32
+
+struct avivo_mmio_stats {
+    unsigned long     reads[AVIVO_MMIO_STATS_REGS];
+    unsigned long     writes[AVIVO_MMIO_STATS_REGS];
+    unsigned long     read_ns[AVIVO_MMIO_STATS_REGS];
+    unsigned long     read_hist[AVIVO_MMIO_HIST_SIZE];
+    unsigned long     total_reads;
+    unsigned long     total_writes;
+    unsigned long     total_read_ns;
+};
+
+struct avivo_mmio {
+    /* FALSE: INREG/OUTREG go straight to the chip */
+    Bool              hooked;
+    enum avivo_mmio_backend backend;
+    struct avivo_mmio_stats *stats;
+    CARD32            *sim_regs;
+    CARD32            *sim_mc;
+    unsigned int      sim_mc_index;
+    struct avivo_mmio_trace *trace;
+    unsigned long     trace_count;
+    unsigned long     start_usec;
+    /* "sim": frame a graphics update was released in, per crtc */
+    CARD32            sim_latch_frame[2];
+    Bool              sim_latch_pending[2];
+};
+
+/* How the register shadow treats a register, see avivo_common.c. */
+enum avivo_reg_policy {
+    AVIVO_REG_CACHED,
+    AVIVO_REG_VOLATILE,
+    AVIVO_REG_WRITE_ONLY
+};
+
+/* crtc2 registers sit this far past their crtc1 counterparts */
+#define AVIVO_CRTC2_OFFSET (AVIVO_CRTC2_H_TOTAL - AVIVO_CRTC1_H_TOTAL)
+
+#define AVIVO_REG_SHADOW_SIZE 16
+
+struct avivo_reg_shadow {
+    unsigned int      value[AVIVO_REG_SHADOW_SIZE];
+    Bool              valid[AVIVO_REG_SHADOW_SIZE];
+    unsigned long     reads;
+    unsigned long     reads_avoided;
+};
+
+/*
+ * Mode validation limits.  Timing registers hold 13 bit fields; scanout
+ * bandwidth is checked against the memory clock, see avivo_mode.c.
+ */
+#define AVIVO_CRTC_TIMING_MAX       0x1fff
+#define AVIVO_CRTC_PITCH_ALIGN      256
+#define AVIVO_CRTC_MIN_CLOCK        25000
+
+/* largest screen per family, see avivo_get_max_size() */
+#define AVIVO_MAX_SIZE              8192
+#define AVIVO_IGP_MAX_SIZE          4096
+
+/* panning log rate limit, usec, and verbosity */
+#define AVIVO_PAN_LOG_INTERVAL      1000000
+#define AVIVO_PAN_LOG_VERB          5
+
+#define AVIVO_MODE_CACHE_SIZE       128
+#define AVIVO_MODE_KEY_SIZE         10
+
+struct avivo_mode_verdict {
+    xf86OutputPtr     output;
+    int               key[AVIVO_MODE_KEY_SIZE];
+    ModeStatus        status;
+};
+
+struct avivo_mode_cache {
+    struct avivo_mode_verdict verdict[AVIVO_MODE_CACHE_SIZE];
+    unsigned long     hits, misses;
+};
+
+#ifdef AVIVO_PAGE_FLIP
+/*
+ * Page flips: a crtc scans out one buffer and has at most one more
+ * latched for its next vblank; the rest wait in a small ring.
+ */
+#define AVIVO_FLIP_QUEUE_SIZE       4
+
+typedef void (*avivo_flip_done_proc)(xf86CrtcPtr crtc, void *data,
+                                     Bool shown);
+
+struct avivo_flip {
+    unsigned long     fb_offset;
+    avivo_flip_done_proc done;
+    void              *data;
+    unsigned long     queued_usec;
+};
+
+struct avivo_flip_queue {
+    struct avivo_flip entry[AVIVO_FLIP_QUEUE_SIZE];
+    int               head, count;
+    /* entry[head] is programmed and waits for vblank */
+    Bool              armed;
+    unsigned long     queued, completed, cancelled, rejected;
+    unsigned long     total_usec, max_usec;
+};
+#endif
+
+/* shadow frame buffer flushes, see avivo_shadow.c; latency in usec */
+#define AVIVO_SHADOW_MAX_LATENCY    20000
+
+/*
+ * Tiles of the shadow and their hash when last flushed: damage in a
+ * tile that hashes the same is already in VRAM.
+ */
+#define AVIVO_SHADOW_TILE           64
+
+struct avivo_shadow_tiles {
+    int               width, height;
+    unsigned long long *hash;
+    /* the flush a tile was last checked in, and what it found */
+    unsigned long     *checked;
+    unsigned char     *state;
+    unsigned long     flush;
+    BoxPtr            boxes;
+    int               boxes_size;
+    unsigned long     tiles_checked, tiles_skipped;
+    unsigned long     bytes_saved, hash_usec;
+};
+
+/* the shadow goes on transparent huge pages where the kernel has them */
+#define AVIVO_SHADOW_HUGE_PAGE      (2 * 1024 * 1024)
+
+struct avivo_shadow {
+    /* the mapping fb_shadow lives in */
+    void              *map;
+    unsigned long     map_size;
+    const struct avivo_blit *blit;
+    /* asked for, and running while the screen is up */
+    int               threads;
+    struct avivo_blit_pool pool;
+    unsigned long     flushes, boxes, bytes;
+    unsigned long     total_usec, max_usec;
+    /* the flushes split over the pool */
+    unsigned long     banded, banded_bytes, banded_usec;
+    /* damage held back until the next frame, see avivo_shadow_delay() */
+    Bool              coalesce;
+    unsigned long     max_latency_usec;
+    RegionRec         pending;
+    unsigned long     pending_usec;
+    unsigned long     flush_usec;
+    CARD32            flush_frame;
+    unsigned long     updates, forced;
+    /* avivo_shadow_block_handler() is registered with dix */
+    Bool              registered;
+    Bool              tile_check;
+    struct avivo_shadow_tiles tiles;
+};
+
+/* stats for avivo_crtc_wait_line(), see avivo_vblank.c */
+struct avivo_vblank {
+    unsigned long     waits, sleeps, timeouts;
+    unsigned long     total_usec, max_usec;
+};
+
+/*
+ * Everything avivo_crtc_mode_set() computes from a mode, kept so that
+ * switching back to a recent mode only replays it.  Keyed on the
+ * adjusted mode's timings, the requested size and the screen layout.
+ */
+#define AVIVO_CRTC_IMAGE_CACHE_SIZE 4
+#define AVIVO_CRTC_IMAGE_KEY_SIZE   (AVIVO_MODE_KEY_SIZE + 6)
+
+struct avivo_crtc_image {
+    int               key[AVIVO_CRTC_IMAGE_KEY_SIZE];
+    Bool              valid;
+    unsigned long     stamp;
+    int               h_total, h_blank, h_sync_wid, h_sync_pol;
+    int               v_total, v_blank, v_sync_wid, v_sync_pol;
+    int               fb_format, fb_length;
+    int               fb_pitch, fb_width, fb_height;
+    struct avivo_pll  pll;
+};
 
 struct avivo_crtc_private {
     FBLinearPtr       fb_rotate;
@@ -64,6 +327,20 @@ struct avivo_crtc_private {
     int               v_total, v_blank, v_sync_wid, v_sync_pol;
     int               fb_format, fb_length;
     int               fb_pitch, fb_width, fb_height;
+    /* mode_set queued a register image not yet applied, and the
+     * dividers it programs */
+    Bool              pending;
+    struct avivo_pll  pending_pll;
+    /* dividers currently programmed in this crtc's PLL */
+    Bool              pll_valid;
+    struct avivo_pll  pll;
+#ifdef AVIVO_PAGE_FLIP
+    struct avivo_flip_queue flip;
+#endif
+    struct avivo_vblank vblank;
+    struct avivo_crtc_image image[AVIVO_CRTC_IMAGE_CACHE_SIZE];
+    unsigned long     image_stamp;
+    unsigned long     image_hits, image_misses;
 };
 
 struct avivo_output_private {
@@ -74,106 +351,57 @@ struct avivo_output_private {
     char              *name;
     void (*setup)(xf86OutputPtr output);
     void (*dpms)(xf86OutputPtr output, int mode);
+    /* commit held back until the batched crtcs are applied */
+    Bool              pending;
 };
 
+/*
+ * Saved chip state.  Which registers are saved, and how they are put
+ * back, is described by a const table in avivo_state.c; the values live
+ * in a flat array indexed like that table.
+ */
+enum avivo_state_access {
+    AVIVO_STATE_MMIO,
+    AVIVO_STATE_MC
+};
+
+enum avivo_state_block {
+    AVIVO_STATE_BLOCK_MC,
+    AVIVO_STATE_BLOCK_VGA,
+    AVIVO_STATE_BLOCK_PLL1,
+    AVIVO_STATE_BLOCK_PLL2,
+    AVIVO_STATE_BLOCK_CRTC1,
+    AVIVO_STATE_BLOCK_CRTC2,
+    AVIVO_STATE_BLOCK_OUTPUT,
+    AVIVO_STATE_BLOCK_CURSOR
+};
+
+/* saved but never written back */
+#define AVIVO_STATE_SAVE_ONLY (1 << 0)
+/* written back through the register shadow */
+#define AVIVO_STATE_SHADOW    (1 << 1)
+/* PLL divider, the whole PLL block is rewritten when one changes */
+#define AVIVO_STATE_PLL_DIVIDER (1 << 2)
+
+struct avivo_state_reg {
+    unsigned int      offset;
+    unsigned char     access;
+    unsigned char     block;
+    unsigned char     flags;
+    const char        *name;
+};
+
+#define AVIVO_STATE_MAX_REGS 128
+
 struct avivo_state
 {
-    int mc_memory_map;
-    int vga_memory_base;
-    int vga_fb_start;
-    int vga_mystery0;
-    int vga_mystery1;
-    int pll1_post_div_cntl;
-    int pll1_post_div;
-    int pll1_post_div_mystery;
-    int pll1_post_mul;
-    int pll1_divider_cntl;
-    int pll1_divider;
-    int pll1_mystery0;
-    int pll1_mystery1;
-    int pll2_post_div_cntl;
-    int pll2_post_div;
-    int pll2_post_div_mystery;
-    int pll2_post_mul;
-    int pll2_divider_cntl;
-    int pll2_divider;
-    int pll2_mystery0;
-    int pll2_mystery1;
-    int crtc_pll_source;
-    int crtc1_h_total;
-    int crtc1_h_blank;
-    int crtc1_h_sync_wid;
-    int crtc1_h_sync_pol;
-    int crtc1_v_total;
-    int crtc1_v_blank;
-    int crtc1_v_sync_wid;
-    int crtc1_v_sync_pol;
-    int crtc1_cntl;
-    int crtc1_blank_status;
-    int crtc1_stereo_status;
-    int crtc1_scan_enable;
-    int crtc1_fb_format;
-    int crtc1_fb_location;
-    int crtc1_fb_end;
-    int crtc1_pitch;
-    int crtc1_x_length;
-    int crtc1_y_length;
-    int crtc1_fb_height;
-    int crtc1_offset_start;
-    int crtc1_offset_end;
-    int crtc1_expn_size;
-    int crtc1_expn_cntl;
-    int crtc1_6594;
-    int crtc1_659c;
-    int crtc1_65a4;
-    int crtc1_65a8;
-    int crtc1_65ac;
-    int crtc1_65b0;
-    int crtc1_65b8;
-    int crtc1_65bc;
-    int crtc1_65c0;
-    int crtc1_65c8;
-    int crtc2_h_total;
-    int crtc2_h_blank;
-    int crtc2_h_sync_wid;
-    int crtc2_h_sync_pol;
-    int crtc2_v_total;
-    int crtc2_v_blank;
-    int crtc2_v_sync_wid;
-    int crtc2_v_sync_pol;
-    int crtc2_cntl;
-    int crtc2_blank_status;
-    int crtc2_scan_enable;
-    int crtc2_fb_format;
-    int crtc2_fb_location;
-    int crtc2_fb_end;
-    int crtc2_pitch;
-    int crtc2_x_length;
-    int crtc2_y_length;
-    int dac1_cntl;
-    int dac1_mystery1;
-    int dac1_mystery2;
-    int tmds1_cntl;
-    int tmds1_mystery1;
-    int tmds1_mystery2;
-    int tmds1_clock_cntl;
-    int tmds1_mystery3;
-    int dac2_cntl;
-    int dac2_mystery1;
-    int dac2_mystery2;
-    int tmds2_cntl;
-    int tmds2_mystery1;
-    int tmds2_mystery2;
-    int tmds2_clock_cntl;
-    int tmds2_mystery3;
-    int cursor1_cntl;
-    int cursor1_location;
-    int cursor1_size;
-    int cursor1_position;
+    CARD32 value[AVIVO_STATE_MAX_REGS];
 };
 
+
 struct avivo_info
 {
+    int scrn_index;
     EntityInfoPtr entity;
     GDevPtr device;
     enum avivo_chip_type chipset;
@@ -192,27 +420,60 @@ struct avivo_info
 
     Bool fb_use_shadow;
     void *fb_shadow;
+    struct avivo_shadow shadow;
     Bool (*create_screen_resources)(ScreenPtr);
 
     unsigned long ctrl_addr, fb_addr;
+    /* fb_size is what the BAR maps, vram_size all the chip has */
     int ctrl_size, fb_size;
+    unsigned long vram_size;
     void *ctrl_base, *fb_base;
+    struct avivo_vram_heap vram;
     struct avivo_state saved_state;
     Bool (*close_screen)(int, ScreenPtr);
     OptionInfoPtr options;
 
     DisplayModePtr lfp_fixed_mode;
 
+    struct avivo_mmio mmio;
+
+    Bool hw_cursor;
     unsigned long cursor_offset;
     int cursor_format, cursor_fg, cursor_bg;
     int cursor_width, cursor_height;
     INT16 cursor_x, cursor_y;
+
+    struct avivo_reg_queue reg_queue;
+    struct avivo_reg_shadow reg_shadow;
+    struct avivo_idle idle;
+    struct avivo_index_cache index_cache;
+    struct avivo_pll_cache pll_cache;
+    struct avivo_mode_cache mode_cache;
+    /* memory clock, kHz, for the watermark calculator */
+    int mclk;
+    /* the watermarks last computed, see avivo_crtc_modes_match() */
+    struct avivo_wm wm;
+#ifdef AVIVO_PAGE_FLIP
+    void (*block_handler)(int, pointer, pointer, pointer);
+#endif
+    /* avivo_adjust_frame() logs at most once per interval */
+    unsigned long pan_log_usec;
+    unsigned long pan_log_suppressed;
+    /* crtc commits held back until avivo_crtc_batch_end() */
+    Bool crtc_batch;
+    /* the RandR handlers we batch, see avivo_rr_crtc_set() */
+    RRCrtcSetProcPtr rr_crtc_set;
+    RRSetConfigProcPtr rr_set_config;
+    /* console state as we left it, see avivo_enter_vt() */
+    Bool console_valid;
+    CARD32 console_fingerprint;
 };
 
 /*
  * avivo chipset
  */
 void avivo_get_chipset(struct avivo_info *avivo);
+void avivo_get_max_size(struct avivo_info *avivo, int *width, int *height);
 
 /*
  * avivo common functions
@@ -230,26 +491,152 @@ unsigned int avivo_get_mc(ScrnInfoPtr screen_info, unsigned int offset);
 void avivo_set_mc(ScrnInfoPtr screen_info,
                   unsigned int offset,
                   unsigned int value);
+void avivo_get_mc_range(ScrnInfoPtr screen_info,
+                        unsigned int offset,
+                        int count,
+                        unsigned int *values);
+void avivo_index_invalidate(struct avivo_info *avivo);
 struct avivo_info *avivo_get_info(ScrnInfoPtr screen_info);
+unsigned long avivo_get_usec(void);
+void avivo_queue_begin(struct avivo_info *avivo);
+void avivo_queue_reg(struct avivo_info *avivo,
+                     unsigned int reg,
+                     unsigned int value);
+unsigned int avivo_queue_read(struct avivo_info *avivo, unsigned int reg);
+void avivo_queue_wait_idle(struct avivo_info *avivo);
+Bool avivo_queue_flush(struct avivo_info *avivo);
+void avivo_queue_cancel(struct avivo_info *avivo);
+unsigned int avivo_reg_read(struct avivo_info *avivo, unsigned int reg);
+void avivo_reg_write(struct avivo_info *avivo,
+                     unsigned int reg,
+                     unsigned int value);
+void avivo_reg_rmw(struct avivo_info *avivo,
+                   unsigned int reg,
+                   unsigned int clear,
+                   unsigned int set);
+void avivo_reg_shadow_invalidate(struct avivo_info *avivo);
+
+/*
+ * avivo mmio backends
+ */
+Bool avivo_mmio_init(ScrnInfoPtr screen_info, const char *backend,
+                     Bool stats);
+void avivo_mmio_fini(ScrnInfoPtr screen_info);
+void avivo_mmio_dump_trace(ScrnInfoPtr screen_info);
+void avivo_mmio_dump_stats(ScrnInfoPtr screen_info);
+int avivo_mmio_get_stats(ScrnInfoPtr screen_info, INT32 *values, int count);
+unsigned int avivo_mmio_read(struct avivo_info *avivo, unsigned int reg);
+void avivo_mmio_write(struct avivo_info *avivo,
+                      unsigned int reg,
+                      unsigned int value);
+
+static __inline__ unsigned int
+avivo_mmio_in(struct avivo_info *avivo, unsigned int reg)
+{
+    if (!avivo->mmio.hooked)
+        return MMIO_IN32(avivo->ctrl_base, reg);
+    return avivo_mmio_read(avivo, reg);
+}
+
+static __inline__ void
+avivo_mmio_out(struct avivo_info *avivo, unsigned int reg, unsigned int value)
+{
+    if (!avivo->mmio.hooked)
+        MMIO_OUT32(avivo->ctrl_base, reg, value);
+    else
+        avivo_mmio_write(avivo, reg, value);
+}
 
 /*
  * avivo bios functions
  */
 DisplayModePtr avivo_bios_get_lfp_timing(ScrnInfoPtr screen_info);
+int avivo_bios_get_mclk(ScrnInfoPtr screen_info);
 
 /*
  * avivo state handling
  */
-void avivo_wait_idle(struct avivo_info *avivo);
-void avivo_restore_state(ScrnInfoPtr screen_info);
+Bool avivo_wait_idle(struct avivo_info *avivo);
+void avivo_idle_dump_stats(ScrnInfoPtr screen_info);
+int avivo_restore_state(ScrnInfoPtr screen_info);
 void avivo_save_state(ScrnInfoPtr screen_info);
+void avivo_save_fonts(ScrnInfoPtr screen_info);
 void avivo_restore_cursor(ScrnInfoPtr screen_info);
 void avivo_save_cursor(ScrnInfoPtr screen_info);
+int avivo_state_num_regs(void);
+const struct avivo_state_reg *avivo_state_get_reg(int i);
+CARD32 avivo_state_fingerprint(ScrnInfoPtr screen_info);
+int avivo_state_diff(const struct avivo_state *a, const struct avivo_state *b,
+                     int *changed);
+void avivo_state_dump(ScrnInfoPtr screen_info, const struct avivo_state *state,
+                      int verb);
+
+/*
+ * avivo mode validation
+ */
+void avivo_mode_key(DisplayModePtr mode, int *key);
+ModeStatus avivo_mode_validate(ScrnInfoPtr screen_info, DisplayModePtr mode);
+ModeStatus avivo_mode_valid_cached(xf86OutputPtr output, DisplayModePtr mode);
+void avivo_mode_wm_head(ScrnInfoPtr screen_info, DisplayModePtr mode,
+                        struct avivo_wm_head *head);
+Bool avivo_mode_bandwidth_ok(xf86CrtcPtr crtc, DisplayModePtr mode);
+void avivo_mode_cache_invalidate(ScrnInfoPtr screen_info);
 
 /*
  * avivo crtc handling
  */
 Bool avivo_crtc_create(ScrnInfoPtr screen_info);
+Bool avivo_crtc_modes_match(ScrnInfoPtr screen_info);
+void avivo_crtc_pll_invalidate(ScrnInfoPtr screen_info);
+void avivo_crtc_batch_begin(ScrnInfoPtr screen_info);
+Bool avivo_crtc_batch_end(ScrnInfoPtr screen_info);
+void avivo_crtc_set_base(xf86CrtcPtr crtc, int x, int y);
+void avivo_crtc_dump_stats(ScrnInfoPtr screen_info);
+/* 64x64 ARGB, in the VRAM heap */
+#define AVIVO_CURSOR_BYTES  (64 * 64 * 4)
+Bool avivo_crtc_cursor_init(ScreenPtr screen);
+void avivo_crtc_cursor_fini(ScreenPtr screen);
+
+/*
+ * avivo page flipping, only built with --enable-page-flip: nothing in
+ * the driver flips, this is for testing the flip path on a card
+ */
+#ifdef AVIVO_PAGE_FLIP
+Bool avivo_crtc_flip(xf86CrtcPtr crtc, unsigned long fb_offset,
+                     avivo_flip_done_proc done, void *data);
+int avivo_crtc_flip_poll(xf86CrtcPtr crtc);
+Bool avivo_crtc_flip_wait(xf86CrtcPtr crtc);
+void avivo_crtc_flip_cancel(xf86CrtcPtr crtc);
+void avivo_flip_cancel_all(ScrnInfoPtr screen_info);
+void avivo_flip_poll_all(ScrnInfoPtr screen_info);
+void avivo_flip_dump_stats(ScrnInfoPtr screen_info);
+#endif
+
+/*
+ * avivo vblank
+ */
+CARD32 avivo_crtc_frame_count(xf86CrtcPtr crtc);
+Bool avivo_crtc_get_position(xf86CrtcPtr crtc, int *line, int *pixel);
+Bool avivo_crtc_vblank_time(xf86CrtcPtr crtc, CARD32 *frame,
+                            unsigned long *usec);
+Bool avivo_crtc_wait_line(xf86CrtcPtr crtc, int line);
+Bool avivo_crtc_wait_vblank(xf86CrtcPtr crtc);
+void avivo_vblank_dump_stats(ScrnInfoPtr screen_info);
+
+/*
+ * avivo shadow frame buffer
+ */
+void avivo_shadow_setup(ScrnInfoPtr screen_info, const char *copy,
+                        int threads);
+void *avivo_shadow_alloc(ScrnInfoPtr screen_info);
+void avivo_shadow_free(ScrnInfoPtr screen_info);
+void avivo_shadow_start(ScreenPtr screen);
+void avivo_shadow_stop(ScreenPtr screen);
+void avivo_shadow_update(ScreenPtr screen, struct _shadowBuf *buf);
+Bool avivo_shadow_register(ScreenPtr screen);
+void avivo_shadow_flush_pending(ScrnInfoPtr screen_info);
+void avivo_shadow_tiles_invalidate(ScrnInfoPtr screen_info);
+void avivo_shadow_dump_stats(ScrnInfoPtr screen_info);
 
 /*
  * avivo output handling
@@ -259,6 +646,8 @@ Bool avivo_output_exist(ScrnInfoPtr screen_info, xf86ConnectorType type,
 Bool avivo_output_init(ScrnInfoPtr screen_info, xf86ConnectorType type,
                        int number, unsigned long ddc_reg);
 Bool avivo_output_setup(ScrnInfoPtr screen_info);
+void avivo_output_commit_pending(ScrnInfoPtr screen_info, Bool enable);
+void avivo_output_commit_enabled(ScrnInfoPtr screen_info);
 DisplayModePtr avivo_output_get_modes(xf86OutputPtr output);
 
 /*
@@ -278,12 +667,21 @@ void avivo_setup_cursor(struct avivo_info *avivo, int id, int enable);
 /*
  * avivo memory
  */
-void avivo_setup_gpu_memory_map(ScrnInfoPtr screen_info);
+Bool avivo_setup_gpu_memory_map(ScrnInfoPtr screen_info);
 FBLinearPtr avivo_xf86AllocateOffscreenLinear(ScreenPtr screen, int length,
         int granularity,
         MoveLinearCallbackProcPtr moveCB,
         RemoveLinearCallbackProcPtr removeCB,
         pointer priv_data);
+Bool avivo_vram_screen_init(ScreenPtr screen);
+unsigned long avivo_vram_alloc(ScrnInfoPtr screen_info, unsigned long size,
+                               unsigned long align);
+void avivo_vram_free(ScrnInfoPtr screen_info, unsigned long offset);
+void avivo_vram_write(ScrnInfoPtr screen_info, unsigned long offset,
+                      const void *data, unsigned long size);
+void avivo_vram_read(ScrnInfoPtr screen_info, unsigned long offset,
+                     void *data, unsigned long size);
+void avivo_vram_dump_stats(ScrnInfoPtr screen_info);
 
 /*
  * avivo i2c 
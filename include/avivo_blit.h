@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo shadow copy: boxes from the shadow frame buffer to VRAM, with
+ * streaming stores where the CPU has them.  Plain C, no X server
+ * types, so avivotool builds it too.
+ */
+#ifndef _AVIVO_BLIT_H_
+#define _AVIVO_BLIT_H_
+
+#include <pthread.h>
+
+/*
+ * Boxes are widened to this many bytes on both sides, so every row is
+ * whole vectors at aligned addresses.  Shadow and VRAM share the
+ * padded pitch, a multiple of it, and the shadow owns every pixel so
+ * copying a few more is harmless.
+ */
+#define AVIVO_BLIT_ALIGN    32
+
+typedef void (*avivo_blit_row_proc)(unsigned char *dst,
+                                    const unsigned char *src, int bytes);
+/*
+ * 64 bit hash of rows bytes wide, bytes a multiple of 4.  Every
+ * variant gives the same value for the same pixels.
+ */
+typedef unsigned long long (*avivo_blit_hash_proc)(const unsigned char *src,
+                                                   int pitch, int bytes,
+                                                   int rows);
+
+struct avivo_blit {
+    const char          *name;
+    int                 (*supported)(void);
+    avivo_blit_row_proc row;
+    /* orders the streaming stores, NULL if there are none */
+    void                (*fence)(void);
+    avivo_blit_hash_proc hash;
+};
+
+/*
+ * Banded copies: the rows a flush covers are cut in one band per
+ * thread, the caller copies the first.  Below AVIVO_BLIT_BAND_MIN_BYTES
+ * waking the workers costs more than it saves.
+ */
+#define AVIVO_BLIT_MAX_THREADS      8
+#define AVIVO_BLIT_BAND_MIN_BYTES   (256 * 1024)
+
+struct avivo_blit_job {
+    const struct avivo_blit *blit;
+    unsigned char       *dst;
+    const unsigned char *src;
+    int                 pitch, cpp;
+    /* x1, y1, x2, y2 per box, the layout of the X server's BoxRec */
+    const short         *boxes;
+    int                 nbox;
+};
+
+struct avivo_blit_pool;
+
+struct avivo_blit_worker {
+    struct avivo_blit_pool *pool;
+    int                 index;
+    pthread_t           thread;
+};
+
+struct avivo_blit_pool {
+    int                 threads;    /* counting the caller */
+    struct avivo_blit_worker worker[AVIVO_BLIT_MAX_THREADS];
+    pthread_mutex_t     lock;
+    pthread_cond_t      start, done;
+    const struct avivo_blit_job *job;
+    int                 y1, y2;
+    unsigned long       generation;
+    int                 running;
+    int                 quit;
+    unsigned long       bytes[AVIVO_BLIT_MAX_THREADS];
+};
+
+const struct avivo_blit *avivo_blit_find(const char *name);
+unsigned long avivo_blit_box(const struct avivo_blit *blit,
+                             unsigned char *dst, const unsigned char *src,
+                             int pitch, int cpp,
+                             int x1, int y1, int x2, int y2);
+unsigned long avivo_blit_band(const struct avivo_blit_job *job,
+                              int y1, int y2);
+int avivo_blit_pool_init(struct avivo_blit_pool *pool, int threads);
+void avivo_blit_pool_fini(struct avivo_blit_pool *pool);
+unsigned long avivo_blit_run(struct avivo_blit_pool *pool,
+                             const struct avivo_blit_job *job,
+                             int *banded);
+
+#endif /* _AVIVO_BLIT_H_ */
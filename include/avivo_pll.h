@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo PLL divider solver.  Plain C, no X server types, so avivotool
+ * builds it too.
+ */
+#ifndef _AVIVO_PLL_H_
+#define _AVIVO_PLL_H_
+
+/*
+ * pixel clock = AVIVO_PLL_REF * mul / (post_div * div), in kHz, with
+ *  - post_div in [AVIVO_PLL_POST_DIV_MIN, AVIVO_PLL_POST_DIV_MAX],
+ *  - div in ]post_div, post_div + AVIVO_PLL_DIV_SPAN[,
+ *  - post_div * div > AVIVO_PLL_MIN_PRODUCT,
+ *  - mul in [1, AVIVO_PLL_MUL_MAX].
+ */
+#define AVIVO_PLL_REF           27000
+#define AVIVO_PLL_POST_DIV_MIN  2
+#define AVIVO_PLL_POST_DIV_MAX  6
+#define AVIVO_PLL_DIV_SPAN      14
+#define AVIVO_PLL_MIN_PRODUCT   20
+#define AVIVO_PLL_MUL_MAX       255
+/* VESA allows 0.5% pixel clock tolerance */
+#define AVIVO_PLL_MAX_PPM       5000
+
+struct avivo_pll {
+    int post_div;
+    int div;
+    int mul;
+    int clock;      /* achieved, kHz, rounded */
+    int ppm;        /* |achieved - target| / target, parts per million */
+};
+
+#define AVIVO_PLL_CACHE_SIZE 16
+
+struct avivo_pll_cache {
+    int target[AVIVO_PLL_CACHE_SIZE];
+    struct avivo_pll pll[AVIVO_PLL_CACHE_SIZE];
+    int count;
+    int next;
+    unsigned long hits, misses;
+};
+
+int avivo_pll_solve(int clock, struct avivo_pll *pll);
+int avivo_pll_table_find(int clock, struct avivo_pll *pll);
+int avivo_pll_get(int clock, struct avivo_pll *pll);
+int avivo_pll_cache_get(struct avivo_pll_cache *cache, int clock,
+                        struct avivo_pll *pll);
+
+#endif /* _AVIVO_PLL_H_ */
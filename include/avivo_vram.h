@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo VRAM heap: the part of VRAM the XFree86 offscreen manager
+ * doesn't cover.  Plain C, no X server types, so avivotool builds it
+ * too.
+ */
+#ifndef _AVIVO_VRAM_H_
+#define _AVIVO_VRAM_H_
+
+#define AVIVO_VRAM_MAX_BLOCKS       32
+#define AVIVO_VRAM_ALIGN            4096
+/* kept back from the offscreen manager when the BAR maps all of VRAM */
+#define AVIVO_VRAM_MIN_HEAP         (256 * 1024)
+
+struct avivo_vram_block {
+    unsigned long     offset, size;
+};
+
+/* blocks are kept sorted by offset */
+struct avivo_vram_heap {
+    unsigned long     start, end;
+    struct avivo_vram_block block[AVIVO_VRAM_MAX_BLOCKS];
+    int               count;
+    unsigned long     allocs, failures;
+    unsigned long     window_bytes;
+};
+
+void avivo_vram_heap_init(struct avivo_vram_heap *heap, unsigned long start,
+                          unsigned long end);
+unsigned long avivo_vram_heap_alloc(struct avivo_vram_heap *heap,
+                                    unsigned long size, unsigned long align);
+int avivo_vram_heap_free(struct avivo_vram_heap *heap, unsigned long offset);
+
+#endif /* _AVIVO_VRAM_H_ */
@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo display priority and line buffer calculator.  Plain C, no X
+ * server types, so avivotool builds it too.
+ */
+#ifndef _AVIVO_WM_H_
+#define _AVIVO_WM_H_
+
+/* used when the BIOS doesn't tell, kHz */
+#define AVIVO_WM_DEFAULT_MCLK   200000
+/* assume the narrowest (64 bit) DDR bus */
+#define AVIVO_WM_BUS_BYTES      8
+/* share of the raw memory bandwidth the display can count on, % */
+#define AVIVO_WM_EFFICIENCY     70
+/* request to data latency of the memory controller and display pipe */
+#define AVIVO_WM_LATENCY_NS     700
+/* the other head fetches this much in one go */
+#define AVIVO_WM_CHUNK_BYTES    512
+/* priority marks count groups of 16 pixels */
+#define AVIVO_WM_MARK_PIXELS    16
+
+struct avivo_wm_head {
+    int clock;      /* kHz, 0 if the crtc is off */
+    int hdisplay;
+    int htotal;
+    int cpp;
+};
+
+struct avivo_wm_params {
+    int mclk;       /* kHz */
+    int bus_bytes;
+    struct avivo_wm_head head[2];
+};
+
+struct avivo_wm {
+    unsigned int lb_split;      /* DC_LB_MEMORY_SPLIT */
+    unsigned int priority[2];   /* CRTCn_PRIORITY_A_CNT */
+    unsigned int priority_b[2]; /* CRTCn_PRIORITY_B_CNT */
+    int latency_ns[2];
+    int available;              /* kB/s */
+    int demand;                 /* kB/s */
+};
+
+int avivo_wm_head_bandwidth(const struct avivo_wm_head *head);
+int avivo_wm_compute(const struct avivo_wm_params *params,
+                     struct avivo_wm *wm);
+
+#endif /* _AVIVO_WM_H_ */
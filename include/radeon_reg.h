@@ -920,6 +920,7 @@
 #define RADEON_MIN_GRANT                    0x0f3e /* PCI */
 #define RADEON_MM_DATA                      0x0004
 #define RADEON_MM_INDEX                     0x0000
+#       define RADEON_MM_APER               (1 << 31) /* frame buffer, not registers */
 #define RADEON_MPLL_CNTL                    0x000e /* PLL */
 #define RADEON_MPP_TB_CONFIG                0x01c0 /* ? */
 #define RADEON_MPP_GP_CONFIG                0x01c8 /* ? */
@@ -3246,7 +3247,20 @@
 #define AVIVO_CRTC1_CNTL					0x6080
 #	define AVIVO_CRTC_EN						(1 << 0)
 #define AVIVO_CRTC1_BLANK_STATUS			0x6084
+#define AVIVO_CRTC1_STATUS				0x609c
+#	define AVIVO_CRTC_V_BLANK				(1 << 0)
+/* scanout position, line in the low half and pixel in the high half */
+#define AVIVO_CRTC1_STATUS_POSITION			0x60a0
+#	define AVIVO_CRTC_V_POSITION_MASK			0x1fff
+#	define AVIVO_CRTC_H_POSITION_SHIFT			16
+#	define AVIVO_CRTC_H_POSITION_MASK			0x1fff
+/* counts vblanks */
+#define AVIVO_CRTC1_STATUS_FRAME_COUNT			0x60a4
 #define AVIVO_CRTC1_STEREO_STATUS			0x60c0
+/* While set, writes to the double-buffered crtc timing registers are
+ * held back; they are latched at the next vblank once it is cleared. */
+#define AVIVO_CRTC1_MASTER_UPDATE_LOCK		0x60e0
+#	define AVIVO_CRTC_MASTER_UPDATE_LOCK		(1 << 0)
 
 /* These all appear to control the scanout from the framebuffer.
  * Flicking SCAN_ENABLE low results in a black screen -- aside from
@@ -3274,6 +3288,10 @@
 #define AVIVO_CRTC1_PITCH					0x6120
 #define AVIVO_CRTC1_X_LENGTH				0x6134
 #define AVIVO_CRTC1_Y_LENGTH				0x6138
+/* Same as the master lock, for the scanout (fb) registers. */
+#define AVIVO_CRTC1_GRPH_UPDATE				0x6144
+#	define AVIVO_CRTC_GRPH_SURFACE_UPDATE_PENDING	(1 << 2)
+#	define AVIVO_CRTC_GRPH_UPDATE_LOCK			(1 << 16)
 
 #define AVIVO_CRTC1_OFFSET_END				0x6454
 
@@ -3282,6 +3300,17 @@
 #define AVIVO_CRTC1_EXPANSION_SOURCE		0x6584
 #define AVIVO_CRTC1_EXPANSION_CNTL			0x6590
 #	define AVIVO_CRTC_EXPANSION_EN				(1 << 0)
+#define AVIVO_DC_LB_MEMORY_SPLIT				0x6520
+#	define AVIVO_DC_LB_MEMORY_SPLIT_MASK			0x3
+#	define AVIVO_DC_LB_MEMORY_SPLIT_D1HALF_D2HALF		0
+#	define AVIVO_DC_LB_MEMORY_SPLIT_D1_3Q_D2_1Q		1
+#	define AVIVO_DC_LB_MEMORY_SPLIT_D1_ONLY		2
+#	define AVIVO_DC_LB_MEMORY_SPLIT_D1_1Q_D2_3Q		3
+#define AVIVO_CRTC1_PRIORITY_A_CNT				0x6548
+#define AVIVO_CRTC1_PRIORITY_B_CNT				0x654c
+#	define AVIVO_CRTC_PRIORITY_MARK_MASK			0x7fff
+#	define AVIVO_CRTC_PRIORITY_OFF				(1 << 16)
+#	define AVIVO_CRTC_PRIORITY_ALWAYS_ON			(1 << 20)
 #define AVIVO_CRTC1_6594					0x6594
 #	define AVIVO_CRTC1_6594_VALUE				((1 << 8) | (1 << 0))
 #define AVIVO_CRTC1_659C					0x659C
@@ -3328,6 +3357,8 @@
 #define AVIVO_CRTC2_OFFSET_START			0x6d80
 #define AVIVO_CRTC2_EXPANSION_SOURCE		0x6d84
 #define AVIVO_CRTC2_EXPANSION_CNTL			0x6d90
+#define AVIVO_CRTC2_PRIORITY_A_CNT				0x6d48
+#define AVIVO_CRTC2_PRIORITY_B_CNT				0x6d4c
 #define AVIVO_CRTC2_6594					0x6d94
 #define AVIVO_CRTC2_659C					0x6d9C
 #define AVIVO_CRTC2_65A4					0x6da4
@@ -39,6 +39,7 @@
 #include "xf86Cursor.h"
 #include "xf86str.h"
 #include "xf86RandR12.h"
+#include "randrstr.h"
 #include "xf86fbman.h"
 #include "shadow.h"
 
@@ -70,6 +71,12 @@ static Bool avivo_close_screen(int index, ScreenPtr screen);
 static Bool avivo_save_screen(ScreenPtr screen, int mode);
 
 static Bool avivo_switch_mode(int index, DisplayModePtr mode, int flags);
+static Bool avivo_rr_crtc_set(ScreenPtr screen, RRCrtcPtr crtc,
+                              RRModePtr mode, int x, int y,
+                              Rotation rotation, int num_outputs,
+                              RROutputPtr *outputs);
+static Bool avivo_rr_set_config(ScreenPtr screen, Rotation rotation,
+                                int rate, RRScreenSizePtr size);
 static void avivo_adjust_frame(int index, int x, int y, int flags);
 static void avivo_free_screen(int index, int flags);
 static void avivo_free_info(ScrnInfoPtr screen_info);
@@ -101,11 +108,29 @@ _X_EXPORT DriverRec avivo_driver = {
 enum avivo_option_type {
     OPTION_LAYOUT,
     OPTION_SHADOW_FB,
+    OPTION_MMIO_BACKEND,
+    OPTION_MMIO_STATS,
+    OPTION_IDLE_TIMEOUT,
+    OPTION_SHADOW_COPY,
+    OPTION_SHADOW_THREADS,
+    OPTION_SHADOW_COALESCE,
+    OPTION_SHADOW_MAX_LATENCY,
+    OPTION_SHADOW_TILE_CHECK,
+    OPTION_HW_CURSOR,
 };
 
 static const OptionInfoRec avivo_options[] = {
     { OPTION_LAYOUT,       "MonitorLayout",     OPTV_STRING,    { 0 },  FALSE },
     { OPTION_SHADOW_FB,    "ShadowFB",         OPTV_BOOLEAN,    { 0 },  FALSE },
+    { OPTION_MMIO_BACKEND, "MMIOBackend",      OPTV_STRING,     { 0 },  FALSE },
+    { OPTION_MMIO_STATS,   "MMIOStats",        OPTV_BOOLEAN,    { 0 },  FALSE },
+    { OPTION_IDLE_TIMEOUT, "IdleTimeout",      OPTV_INTEGER,    { 0 },  FALSE },
+    { OPTION_SHADOW_COPY,  "ShadowCopy",       OPTV_STRING,     { 0 },  FALSE },
+    { OPTION_SHADOW_THREADS, "ShadowThreads",  OPTV_INTEGER,    { 0 },  FALSE },
+    { OPTION_SHADOW_COALESCE, "ShadowCoalesce", OPTV_BOOLEAN,    { 0 },  FALSE },
+    { OPTION_SHADOW_MAX_LATENCY, "ShadowMaxLatency", OPTV_INTEGER, { 0 },  FALSE },
+    { OPTION_SHADOW_TILE_CHECK, "ShadowTileCheck", OPTV_BOOLEAN, { 0 },  FALSE },
+    { OPTION_HW_CURSOR,    "HWCursor",         OPTV_BOOLEAN,    { 0 },  FALSE },
     { -1,                  NULL,                OPTV_NONE,      { 0 },  FALSE }
 };
 
@@ -335,6 +360,7 @@ avivo_old_probe(DriverPtr drv, int flags)
 static void
 avivo_free_info(ScrnInfoPtr screen_info)
 {
+    avivo_mmio_fini(screen_info);
 }
 
 /*
@@ -345,7 +371,7 @@ static Bool
 avivo_preinit(ScrnInfoPtr screen_info, int flags)
 {
     struct avivo_info *avivo;
-    int i;
+    int i, timeout, threads;
     Gamma gzeros = { 0.0, 0.0, 0.0 };
     rgb rzeros = { 0, 0, 0 };
 
@@ -391,12 +417,12 @@ avivo_preinit(ScrnInfoPtr screen_info, int flags)
     for (i = 0; i < 6; i++) {
         if (avivo->pci_info->size[i] >= 26) {
             avivo->fb_addr = avivo->pci_info->memBase[i] & 0xfe000000;
-            avivo->fb_size = INREG(RADEON_CONFIG_MEMSIZE);
-            /* FIXME: we can't map more than 256Mo better solution would be
-             * to get aperture size */
-            if (avivo->fb_size > 0x10000000)
-                avivo->fb_size = 0x10000000;
-            screen_info->videoRam = avivo->fb_size / 1024;
+            avivo->vram_size = INREG(RADEON_CONFIG_MEMSIZE);
+            /* map what the BAR covers, the rest goes through a window */
+            avivo->fb_size = 1 << avivo->pci_info->size[i];
+            if (avivo->fb_size > avivo->vram_size)
+                avivo->fb_size = avivo->vram_size;
+            screen_info->videoRam = avivo->vram_size / 1024;
             avivo_map_fb_mem(screen_info);
         }
     }
@@ -458,21 +484,16 @@ avivo_preinit(ScrnInfoPtr screen_info, int flags)
             }
             avivo->fb_addr = avivo->pci_info->regions[i].base_addr;
             avivo->fb_base = avivo->pci_info->regions[i].memory ;
-            avivo->fb_size = INREG(RADEON_CONFIG_MEMSIZE);
+            avivo->vram_size = INREG(RADEON_CONFIG_MEMSIZE);
+            avivo->fb_size = avivo->vram_size;
             /*
-             * fb memory size should be the minum of bar size
-             * and the result of INREG(RADEON_CONFIG_MEMSIZE);
-             * Normally both should be the same, but who knows
-             * what some card manufacturers do sometimes ...
+             * the CPU only sees what the BAR maps, which is smaller
+             * than VRAM on boards with a 256Mo aperture; the rest is
+             * reached through a window, see avivo_vram_write()
              */
             if (avivo->pci_info->regions[i].size < avivo->fb_size)
                 avivo->fb_size = avivo->pci_info->regions[i].size ;
-
-            /* FIXME: we can't map more than 256Mo better solution would be
-             * to get aperture size */
-            if (avivo->fb_size > 0x10000000)
-                avivo->fb_size = 0x10000000;
-            screen_info->videoRam = avivo->fb_size / 1024;
+            screen_info->videoRam = avivo->vram_size / 1024;
         }
     }
 
@@ -483,6 +504,10 @@ avivo_preinit(ScrnInfoPtr screen_info, int flags)
     xf86DrvMsg(screen_info->scrnIndex, X_INFO,
                "Frame buffer memory at %p[size = %d, 0x%08X]\n",
                (void *)avivo->fb_addr, avivo->fb_size, avivo->fb_size);
+    if (avivo->vram_size > avivo->fb_size)
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "%lu kB of VRAM past the aperture\n",
+                   (avivo->vram_size - avivo->fb_size) / 1024);
 
     /* now we got PCI informations we can check which chipset family we
      * have to deal with
@@ -518,11 +543,56 @@ avivo_preinit(ScrnInfoPtr screen_info, int flags)
     /* use shadow framebuffer by default */
     avivo->fb_use_shadow = xf86ReturnOptValBool(avivo->options,
                                                 OPTION_SHADOW_FB, TRUE);
+    /* "c", "sse2", "avx2" or "auto", and threads for large flushes */
+    if (avivo->fb_use_shadow) {
+        threads = 1;
+        xf86GetOptValInteger(avivo->options, OPTION_SHADOW_THREADS, &threads);
+        avivo_shadow_setup(screen_info,
+                           xf86GetOptValString(avivo->options,
+                                               OPTION_SHADOW_COPY),
+                           threads);
+        /* flush once per frame, nothing waits more than the cap, in ms */
+        avivo->shadow.coalesce = xf86ReturnOptValBool(avivo->options,
+                                                      OPTION_SHADOW_COALESCE,
+                                                      FALSE);
+        avivo->shadow.max_latency_usec = AVIVO_SHADOW_MAX_LATENCY;
+        if (xf86GetOptValInteger(avivo->options, OPTION_SHADOW_MAX_LATENCY,
+                                 &timeout) && timeout > 0)
+            avivo->shadow.max_latency_usec = timeout * 1000;
+        /* hash damaged tiles, don't copy the ones that didn't change */
+        avivo->shadow.tile_check = xf86ReturnOptValBool(avivo->options,
+                                                        OPTION_SHADOW_TILE_CHECK,
+                                                        FALSE);
+    }
+    /* cursor images live in the VRAM heap */
+    avivo->hw_cursor = xf86ReturnOptValBool(avivo->options, OPTION_HW_CURSOR,
+                                            FALSE);
+    /* how long to wait for the chip to go idle, in ms */
+    if (xf86GetOptValInteger(avivo->options, OPTION_IDLE_TIMEOUT, &timeout) &&
+        timeout > 0)
+        avivo->idle.timeout_usec = timeout * 1000;
+    /* everything above probed the real chip, from now on registers go
+     * through whatever backend was asked for */
+    if (!avivo_mmio_init(screen_info,
+                         xf86GetOptValString(avivo->options,
+                                             OPTION_MMIO_BACKEND),
+                         xf86ReturnOptValBool(avivo->options,
+                                              OPTION_MMIO_STATS, FALSE)))
+        return FALSE;
 
     /* create crtrc & output */
     if (!avivo_crtc_create(screen_info))
         return FALSE;
     avivo_output_setup(screen_info);
+    avivo->mclk = avivo_bios_get_mclk(screen_info);
+    if (avivo->mclk > 0)
+        xf86DrvMsg(screen_info->scrnIndex, X_PROBED,
+                   "memory clock %d kHz\n", avivo->mclk);
+    else {
+        avivo->mclk = AVIVO_WM_DEFAULT_MCLK;
+        xf86DrvMsg(screen_info->scrnIndex, X_DEFAULT,
+                   "memory clock unknown, assuming %d kHz\n", avivo->mclk);
+    }
     if (!xf86InitialConfiguration(screen_info, FALSE)) {
         xf86DrvMsg(screen_info->scrnIndex, X_ERROR, "No valid modes.\n");
         return FALSE;
@@ -575,24 +645,6 @@ avivo_save_screen(ScreenPtr screen, int mode)
     return TRUE;
 }
 
-static void *
-avivo_window_linear(ScreenPtr screen, CARD32 row, CARD32 offset, int mode,
-                    CARD32 *size, void *closure)
-{
-    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
-    struct avivo_info *avivo = avivo_get_info(screen_info);
-    int stride;
-#if 0
-    if (!screen_info->vtSema)
-        return NULL;
-#endif
-    stride = (screen_info->displayWidth * screen_info->bitsPerPixel) / 8;
-    *size = stride;
-
-    return ((CARD8 *)avivo->fb_base + screen_info->fbOffset +
-            row * stride + offset);
-}
-
 static Bool
 avivo_create_screen_resources(ScreenPtr screen)
 {
@@ -609,8 +661,10 @@ avivo_create_screen_resources(ScreenPtr screen)
 
     pixmap = screen->GetScreenPixmap(screen);
 
-    if (!shadowAdd(screen, pixmap, shadowUpdatePackedWeak(),
-                   avivo_window_linear, 0, NULL))
+    if (!shadowAdd(screen, pixmap, avivo_shadow_update, NULL, 0, NULL))
+        return FALSE;
+    /* after shadowAdd, so our block handler runs after the shadow's */
+    if (!avivo_shadow_register(screen))
         return FALSE;
 
     return TRUE;
@@ -628,16 +682,37 @@ avivo_shadow_init(ScreenPtr screen)
      
     avivo->create_screen_resources = screen->CreateScreenResources;
     screen->CreateScreenResources = avivo_create_screen_resources;
+    avivo_shadow_start(screen);
      
     return TRUE;
 }
 
+#ifdef AVIVO_PAGE_FLIP
+/* retire page flips that went out since we last looked */
+static void
+avivo_block_handler(int index, pointer block_data, pointer timeout,
+                    pointer read_mask)
+{
+    ScreenPtr screen = screenInfo.screens[index];
+    ScrnInfoPtr screen_info = xf86Screens[index];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+
+    screen->BlockHandler = avivo->block_handler;
+    (*screen->BlockHandler)(index, block_data, timeout, read_mask);
+    screen->BlockHandler = avivo_block_handler;
+
+    if (screen_info->vtSema)
+        avivo_flip_poll_all(screen_info);
+}
+#endif
+
 static Bool
 avivo_screen_init(int index, ScreenPtr screen, int argc, char **argv)
 {
     ScrnInfoPtr screen_info = xf86Screens[index];
     struct avivo_info *avivo = avivo_get_info(screen_info);
     xf86CrtcConfigPtr xf86_config = XF86_CRTC_CONFIG_PTR(screen_info);
+    rrScrPrivPtr rr_priv;
     VisualPtr visual;
     void *fbstart;
     int i;
@@ -655,14 +730,18 @@ avivo_screen_init(int index, ScreenPtr screen, int argc, char **argv)
     for (i = 0; i < 6; i++) {
         if (avivo->pci_info->size[i] >= 26) {
             avivo->fb_addr = avivo->pci_info->memBase[i] & 0xfe000000;
-            avivo->fb_size = INREG(RADEON_CONFIG_MEMSIZE);
-            screen_info->videoRam = avivo->fb_size / 1024;
+            avivo->vram_size = INREG(RADEON_CONFIG_MEMSIZE);
+            avivo->fb_size = 1 << avivo->pci_info->size[i];
+            if (avivo->fb_size > avivo->vram_size)
+                avivo->fb_size = avivo->vram_size;
+            screen_info->videoRam = avivo->vram_size / 1024;
             avivo_map_fb_mem(screen_info);
         }
     }
 #endif
     avivo_save_state(screen_info);
-    avivo_setup_gpu_memory_map(screen_info);
+    if (!avivo_setup_gpu_memory_map(screen_info))
+        return FALSE;
     /* display width is the higher resolution from width & height */
     if (screen_info->virtualX > screen_info->displayWidth)
         screen_info->displayWidth = screen_info->virtualX;
@@ -689,10 +768,7 @@ avivo_screen_init(int index, ScreenPtr screen, int argc, char **argv)
         return FALSE;
     }
     if (avivo->fb_use_shadow) {
-        avivo->fb_shadow = xcalloc(1,
-                                   screen_info->virtualX *
-                                   screen_info->virtualY *
-                                   screen_info->bitsPerPixel / 8);
+        avivo->fb_shadow = avivo_shadow_alloc(screen_info);
         if (avivo->fb_shadow == NULL) {
             xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
                        "Failed to allocate shadow framebuffer\n");
@@ -728,6 +804,11 @@ avivo_screen_init(int index, ScreenPtr screen, int argc, char **argv)
     fbPictureInit(screen, 0, 0);
     xf86SetBlackWhitePixels(screen);
 
+    /* rotation shadows and offscreen surfaces */
+    if (!avivo_vram_screen_init(screen))
+        xf86DrvMsg(screen_info->scrnIndex, X_WARNING,
+                   "no offscreen memory\n");
+
     if (avivo->fb_use_shadow && !avivo_shadow_init(screen)) {
         xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
                    "shadow framebuffer initialization failed\n");
@@ -759,6 +840,11 @@ avivo_screen_init(int index, ScreenPtr screen, int argc, char **argv)
     xf86DPMSInit(screen, xf86DPMSSet, 0);
 
     miDCInitialize(screen, xf86GetPointerScreenFuncs());
+    if (avivo->hw_cursor && !avivo_crtc_cursor_init(screen)) {
+        xf86DrvMsg(screen_info->scrnIndex, X_WARNING,
+                   "hardware cursor initialization failed\n");
+        avivo->hw_cursor = FALSE;
+    }
 
     if (!miCreateDefColormap(screen)) {
         xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
@@ -773,12 +859,22 @@ avivo_screen_init(int index, ScreenPtr screen, int argc, char **argv)
     screen->SaveScreen = avivo_save_screen;
     avivo->close_screen = screen->CloseScreen;
     screen->CloseScreen = avivo_close_screen;
+#ifdef AVIVO_PAGE_FLIP
+    avivo->block_handler = screen->BlockHandler;
+    screen->BlockHandler = avivo_block_handler;
+#endif
 
     if (!xf86CrtcScreenInit(screen)) {
         xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
                    "Couldn't initialize crtc\n");
         return FALSE;
     }
+    /* xf86CrtcScreenInit() just installed the RandR handlers */
+    rr_priv = rrGetScrPriv(screen);
+    avivo->rr_crtc_set = rr_priv->rrCrtcSet;
+    rr_priv->rrCrtcSet = avivo_rr_crtc_set;
+    avivo->rr_set_config = rr_priv->rrSetConfig;
+    rr_priv->rrSetConfig = avivo_rr_set_config;
 
     xf86DrvMsg(screen_info->scrnIndex, X_INFO, "initialization successfull\n");
     return TRUE;
@@ -788,20 +884,47 @@ static Bool
 avivo_enter_vt(int index, int flags)
 {
     ScrnInfoPtr screen_info = xf86Screens[index];
-    vgaHWPtr vga_hw = VGAHWPTR(screen_info);
-
-#ifdef WITH_VGAHW
-    vgaHWUnlock(vga_hw);
-    vgaHWSave(screen_info, &vga_hw->SavedReg, VGA_SR_MODE | VGA_SR_FONTS);
-    vgaHWLock(vga_hw);
-#endif
-    avivo_save_state(screen_info);
-    avivo_setup_gpu_memory_map(screen_info);
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    unsigned long start = avivo_get_usec();
+    Bool console_unchanged, modes_unchanged, ret;
+
+    /* the console may have moved the index registers */
+    avivo_index_invalidate(avivo);
+    /* if the console left the chip as we restored it, the snapshot we
+     * took last time (VGA fonts included) is still good */
+    console_unchanged = avivo->console_valid &&
+        avivo_state_fingerprint(screen_info) == avivo->console_fingerprint;
+    if (console_unchanged) {
+        avivo_reg_shadow_invalidate(avivo);
+        avivo_save_fonts(screen_info);
+    } else
+        avivo_save_state(screen_info);
+    if (!avivo_setup_gpu_memory_map(screen_info))
+        return FALSE;
+    /* the console drew over what we flushed */
+    if (avivo->fb_shadow)
+        avivo_shadow_tiles_invalidate(screen_info);
 
     screen_info->vtSema = TRUE;
-    if (!xf86SetDesiredModes(screen_info))
-        return FALSE;
+    /* only trust the crtcs when the console didn't touch anything either */
+    modes_unchanged = console_unchanged &&
+        avivo_crtc_modes_match(screen_info);
+    if (!modes_unchanged) {
+        /* all crtcs latch their new mode at once */
+        avivo_crtc_batch_begin(screen_info);
+        ret = xf86SetDesiredModes(screen_info);
+        if (!avivo_crtc_batch_end(screen_info) || !ret)
+            return FALSE;
+    } else {
+        /* the check doesn't cover the outputs, cheap to redo anyway */
+        avivo_output_commit_enabled(screen_info);
+    }
     avivo_adjust_frame(index, screen_info->frameX0, screen_info->frameY0, 0);
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "enter VT in %lu us (%s state, %s modes)\n",
+               avivo_get_usec() - start,
+               console_unchanged ? "reused" : "saved",
+               modes_unchanged ? "kept" : "set");
 
     return TRUE;
 }
@@ -810,20 +933,37 @@ static void
 avivo_leave_vt(int index, int flags)
 {
     ScrnInfoPtr screen_info = xf86Screens[index];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
     vgaHWPtr vga_hw = VGAHWPTR(screen_info);
+    unsigned long start = avivo_get_usec();
+    int written;
 
-    avivo_restore_state(screen_info);
+#ifdef AVIVO_PAGE_FLIP
+    avivo_flip_cancel_all(screen_info);
+#endif
+    if (avivo->fb_shadow)
+        avivo_shadow_flush_pending(screen_info);
+    written = avivo_restore_state(screen_info);
+    avivo_crtc_pll_invalidate(screen_info);
 #ifdef WITH_VGAHW
     vgaHWUnlock(vga_hw);
     vgaHWRestore(screen_info, &vga_hw->SavedReg, VGA_SR_MODE | VGA_SR_FONTS);
     vgaHWLock(vga_hw);
 #endif
+    /* remember what we gave back, see avivo_enter_vt() */
+    avivo->console_fingerprint = avivo_state_fingerprint(screen_info);
+    avivo->console_valid = TRUE;
+    avivo_index_invalidate(avivo);
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "leave VT: %d of %d registers restored in %lu us\n",
+               written, avivo_state_num_regs(), avivo_get_usec() - start);
 }
 
 static Bool
 avivo_switch_mode(int index, DisplayModePtr mode, int flags)
 {
     ScrnInfoPtr screen_info = xf86Screens[index];
+    Bool ret;
 
     xf86DrvMsg(screen_info->scrnIndex, X_INFO,
                "set mode: hdisp %d, htotal %d, hss %d, hse %d, hsk %d\n",
@@ -834,7 +974,40 @@ avivo_switch_mode(int index, DisplayModePtr mode, int flags)
                mode->VDisplay, mode->VTotal, mode->VSyncStart, mode->VSyncEnd, 
                mode->VScan);
  
-    return xf86SetSingleMode (screen_info, mode, RR_Rotate_0);
+    /* every crtc the new mode touches latches it at once */
+    avivo_crtc_batch_begin(screen_info);
+    ret = xf86SetSingleMode (screen_info, mode, RR_Rotate_0);
+    return avivo_crtc_batch_end(screen_info) && ret;
+}
+
+/* RandR 1.2 requests, batched like avivo_switch_mode() */
+static Bool
+avivo_rr_crtc_set(ScreenPtr screen, RRCrtcPtr crtc, RRModePtr mode,
+                  int x, int y, Rotation rotation, int num_outputs,
+                  RROutputPtr *outputs)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    Bool ret;
+
+    avivo_crtc_batch_begin(screen_info);
+    ret = avivo->rr_crtc_set(screen, crtc, mode, x, y, rotation,
+                             num_outputs, outputs);
+    return avivo_crtc_batch_end(screen_info) && ret;
+}
+
+/* RandR 1.1 size changes */
+static Bool
+avivo_rr_set_config(ScreenPtr screen, Rotation rotation, int rate,
+                    RRScreenSizePtr size)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    Bool ret;
+
+    avivo_crtc_batch_begin(screen_info);
+    ret = avivo->rr_set_config(screen, rotation, rate, size);
+    return avivo_crtc_batch_end(screen_info) && ret;
 }
 
 static void
@@ -845,17 +1018,21 @@ avivo_adjust_frame(int index, int x, int y, int flags)
     xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
     xf86OutputPtr output = config->output[config->compat_output];
     xf86CrtcPtr crtc = output->crtc;
-    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    unsigned long now;
+
+    /* panning calls this for every pointer motion, keep the log sane */
+    now = avivo_get_usec();
+    if (now - avivo->pan_log_usec >= AVIVO_PAN_LOG_INTERVAL) {
+        xf86DrvMsgVerb(screen_info->scrnIndex, X_INFO, AVIVO_PAN_LOG_VERB,
+                       "adjust frame: %d %d %d %d (%lu not logged)\n",
+                       index, x, y, flags, avivo->pan_log_suppressed);
+        avivo->pan_log_usec = now;
+        avivo->pan_log_suppressed = 0;
+    } else
+        avivo->pan_log_suppressed++;
 
-    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
-               "adjust frame: %d %d %d %d\n", index, x, y, flags);
     if (crtc && crtc->enabled) {
-        x = x & ~3;
-        OUTREG(AVIVO_CRTC1_OFFSET_START + avivo_crtc->crtc_offset,
-               (x << 16) | y);
-        OUTREG(AVIVO_CRTC1_OFFSET_END + avivo_crtc->crtc_offset,
-            ((crtc->mode.HDisplay + x - 128) << 16) |
-            (crtc->mode.HDisplay + y -128));
+        avivo_crtc_set_base(crtc, x, y);
         crtc->x = output->initial_x + x;
         crtc->y = output->initial_y + y;
     }
@@ -880,9 +1057,32 @@ avivo_close_screen(int index, ScreenPtr screen)
     struct avivo_info *avivo = avivo_get_info(screen_info);
 
     xf86DrvMsg(screen_info->scrnIndex, X_INFO, "close screen\n");
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "register shadow: %lu MMIO reads avoided, %lu issued\n",
+               avivo->reg_shadow.reads_avoided, avivo->reg_shadow.reads);
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "index cache: %lu index writes avoided\n",
+               avivo->index_cache.writes_avoided);
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "mode cache: %lu verdicts reused, %lu computed\n",
+               avivo->mode_cache.hits, avivo->mode_cache.misses);
     if (screen_info->vtSema == TRUE) {
         avivo_leave_vt(index, 0);
     }
+    avivo_mmio_dump_trace(screen_info);
+    avivo_mmio_dump_stats(screen_info);
+    avivo_idle_dump_stats(screen_info);
+    avivo_crtc_dump_stats(screen_info);
+#ifdef AVIVO_PAGE_FLIP
+    avivo_flip_dump_stats(screen_info);
+#endif
+    avivo_vblank_dump_stats(screen_info);
+    avivo_shadow_dump_stats(screen_info);
+    if (avivo->hw_cursor) {
+        xf86_cursors_fini(screen);
+        avivo_crtc_cursor_fini(screen);
+    }
+    avivo_vram_dump_stats(screen_info);
     avivo_unmap_ctrl_mem(screen_info);
     avivo_unmap_fb_mem(screen_info);
 #ifdef WITH_VGAHW
@@ -891,10 +1091,14 @@ avivo_close_screen(int index, ScreenPtr screen)
     screen_info->vtSema = FALSE;
 
     if (avivo->fb_shadow) {
-        xfree(avivo->fb_shadow);
+        avivo_shadow_stop(screen);
+        avivo_shadow_free(screen_info);
         avivo->fb_shadow = NULL;
     }
 
+#ifdef AVIVO_PAGE_FLIP
+    screen->BlockHandler = avivo->block_handler;
+#endif
     screen->CloseScreen = avivo->close_screen;
     return screen->CloseScreen(index, screen);
 }
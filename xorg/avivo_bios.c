@@ -30,7 +30,9 @@
 
 #define ATOM_OFFSET_ROM_HEADER_OFFSET                       72
 #define     ATOM_ROM_HEADER_MASTER_OFFSET                       32
+#define     ATOM_MASTER_FIRMWARE_INFO_OFFSET                    12
 #define     ATOM_MASTER_LFP_OFFSET                              16
+#define     ATOM_FIRMWARE_DEFAULT_MCLK                          12
 #define     ATOM_LFP_XRES                                       6
 #define     ATOM_LFP_YRES                                       10
 #define     ATOM_LFP_DOT_CLOCK                                  4
@@ -284,3 +286,19 @@ avivo_bios_get_lfp_timing(ScrnInfoPtr screen_info)
     mode->prev       = NULL;
     return mode;
 }
+
+/* default memory clock in kHz, 0 if the BIOS doesn't say */
+int
+avivo_bios_get_mclk(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    int offset;
+
+    if (!avivo->is_atom_bios || avivo->vbios == NULL)
+        return 0;
+    offset = BIOS16(avivo->master_offset + ATOM_MASTER_FIRMWARE_INFO_OFFSET);
+    if (!offset)
+        return 0;
+    /* stored in 10 kHz units */
+    return BIOS32(offset + ATOM_FIRMWARE_DEFAULT_MCLK) * 10;
+}
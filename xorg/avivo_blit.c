@@ -0,0 +1,445 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo shadow copy.  VRAM is mapped write combined: stores that skip
+ * the cache and fill whole lines go out as full bursts and don't evict
+ * the shadow we copy from.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+#include "avivo_blit.h"
+
+#if defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    (defined(__i386__) || defined(__x86_64__))
+#define AVIVO_BLIT_X86 1
+#include <immintrin.h>
+#endif
+
+static int
+avivo_blit_always(void)
+{
+    return 1;
+}
+
+static void
+avivo_blit_row_c(unsigned char *dst, const unsigned char *src, int bytes)
+{
+    memcpy(dst, src, bytes);
+}
+
+/*
+ * The hash runs 64 bit FNV-1a over 32 bit words in 8 lanes, word i of
+ * a row going to lane i % 8, then folds the lanes the same way.  Each
+ * step is a bijection of the state, so a tile with a single word
+ * changed always hashes differently.  Other changes collide about as
+ * often as two 64 bit values, 2^-64; FNV is not a cryptographic hash
+ * though, pixels crafted to collide will.
+ */
+#define AVIVO_BLIT_HASH_LANES   8
+#define AVIVO_BLIT_HASH_SEED    14695981039346656037ull
+#define AVIVO_BLIT_HASH_PRIME   1099511628211ull
+
+static unsigned long long
+avivo_blit_hash_fold(const unsigned long long *lane)
+{
+    unsigned long long hash = AVIVO_BLIT_HASH_SEED;
+    int i;
+
+    for (i = 0; i < AVIVO_BLIT_HASH_LANES; i++)
+        hash = (hash ^ lane[i]) * AVIVO_BLIT_HASH_PRIME;
+    return hash;
+}
+
+static void
+avivo_blit_hash_words(unsigned long long *lane, const unsigned int *word,
+                      int first, int words)
+{
+    int i;
+
+    for (i = first; i < words; i++)
+        lane[i % AVIVO_BLIT_HASH_LANES] =
+            (lane[i % AVIVO_BLIT_HASH_LANES] ^ word[i]) *
+            AVIVO_BLIT_HASH_PRIME;
+}
+
+static unsigned long long
+avivo_blit_hash_c(const unsigned char *src, int pitch, int bytes, int rows)
+{
+    unsigned long long lane[AVIVO_BLIT_HASH_LANES];
+    const unsigned int *word;
+    int i, l, words = bytes / 4;
+
+    for (i = 0; i < AVIVO_BLIT_HASH_LANES; i++)
+        lane[i] = AVIVO_BLIT_HASH_SEED;
+    for (; rows; rows--, src += pitch) {
+        word = (const unsigned int *)src;
+        for (i = 0; i + AVIVO_BLIT_HASH_LANES <= words;
+             i += AVIVO_BLIT_HASH_LANES)
+            for (l = 0; l < AVIVO_BLIT_HASH_LANES; l++)
+                lane[l] = (lane[l] ^ word[i + l]) * AVIVO_BLIT_HASH_PRIME;
+        avivo_blit_hash_words(lane, word, i, words);
+    }
+    return avivo_blit_hash_fold(lane);
+}
+
+#ifdef AVIVO_BLIT_X86
+static int
+avivo_blit_has_sse2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+/* dst is 16 byte aligned and bytes a multiple of 16 */
+__attribute__((target("sse2"))) static void
+avivo_blit_row_sse2(unsigned char *dst, const unsigned char *src, int bytes)
+{
+    __m128i *d = (__m128i *)dst;
+    const __m128i *s = (const __m128i *)src;
+    __m128i a, b, c, e;
+    int n;
+
+    for (n = bytes / 64; n; n--) {
+        a = _mm_loadu_si128(s);
+        b = _mm_loadu_si128(s + 1);
+        c = _mm_loadu_si128(s + 2);
+        e = _mm_loadu_si128(s + 3);
+        _mm_stream_si128(d, a);
+        _mm_stream_si128(d + 1, b);
+        _mm_stream_si128(d + 2, c);
+        _mm_stream_si128(d + 3, e);
+        s += 4;
+        d += 4;
+    }
+    for (n = (bytes & 63) / 16; n; n--)
+        _mm_stream_si128(d++, _mm_loadu_si128(s++));
+}
+
+__attribute__((target("sse2"))) static void
+avivo_blit_fence_sse2(void)
+{
+    _mm_sfence();
+}
+
+static int
+avivo_blit_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/* dst is 32 byte aligned and bytes a multiple of 32 */
+__attribute__((target("avx2"))) static void
+avivo_blit_row_avx2(unsigned char *dst, const unsigned char *src, int bytes)
+{
+    __m256i *d = (__m256i *)dst;
+    const __m256i *s = (const __m256i *)src;
+    __m256i a, b, c, e;
+    int n;
+
+    for (n = bytes / 128; n; n--) {
+        a = _mm256_loadu_si256(s);
+        b = _mm256_loadu_si256(s + 1);
+        c = _mm256_loadu_si256(s + 2);
+        e = _mm256_loadu_si256(s + 3);
+        _mm256_stream_si256(d, a);
+        _mm256_stream_si256(d + 1, b);
+        _mm256_stream_si256(d + 2, c);
+        _mm256_stream_si256(d + 3, e);
+        s += 4;
+        d += 4;
+    }
+    for (n = (bytes & 127) / 32; n; n--)
+        _mm256_stream_si256(d++, _mm256_loadu_si256(s++));
+}
+
+/*
+ * h * AVIVO_BLIT_HASH_PRIME in each 64 bit lane.  AVX2 has no 64 bit
+ * multiply, but the prime is 2^40 + 0x1b3.
+ */
+__attribute__((target("avx2"))) static __m256i
+avivo_blit_hash_mul_avx2(__m256i h)
+{
+    const __m256i low = _mm256_set1_epi64x(0x1b3);
+    __m256i lo = _mm256_mul_epu32(h, low);
+    __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(h, 32), low);
+
+    return _mm256_add_epi64(_mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)),
+                            _mm256_slli_epi64(h, 40));
+}
+
+/* avivo_blit_hash_c(), a whole row of lanes per two registers */
+__attribute__((target("avx2"))) static unsigned long long
+avivo_blit_hash_avx2(const unsigned char *src, int pitch, int bytes, int rows)
+{
+    __m256i h0 = _mm256_set1_epi64x(AVIVO_BLIT_HASH_SEED);
+    __m256i h1 = h0, w0, w1;
+    unsigned long long lane[AVIVO_BLIT_HASH_LANES];
+    const __m128i *s;
+    int i, chunks = bytes / 32;
+
+    for (; rows; rows--, src += pitch) {
+        s = (const __m128i *)src;
+        for (i = 0; i < chunks; i++) {
+            w0 = _mm256_cvtepu32_epi64(_mm_loadu_si128(s + 2 * i));
+            w1 = _mm256_cvtepu32_epi64(_mm_loadu_si128(s + 2 * i + 1));
+            h0 = avivo_blit_hash_mul_avx2(_mm256_xor_si256(h0, w0));
+            h1 = avivo_blit_hash_mul_avx2(_mm256_xor_si256(h1, w1));
+        }
+        if (bytes & 31) {
+            _mm256_storeu_si256((__m256i *)lane, h0);
+            _mm256_storeu_si256((__m256i *)lane + 1, h1);
+            avivo_blit_hash_words(lane, (const unsigned int *)src,
+                                  chunks * 8, bytes / 4);
+            h0 = _mm256_loadu_si256((const __m256i *)lane);
+            h1 = _mm256_loadu_si256((const __m256i *)lane + 1);
+        }
+    }
+    _mm256_storeu_si256((__m256i *)lane, h0);
+    _mm256_storeu_si256((__m256i *)lane + 1, h1);
+    return avivo_blit_hash_fold(lane);
+}
+#endif
+
+/* best first */
+static const struct avivo_blit avivo_blits[] = {
+#ifdef AVIVO_BLIT_X86
+    { "avx2", avivo_blit_has_avx2, avivo_blit_row_avx2,
+      avivo_blit_fence_sse2, avivo_blit_hash_avx2 },
+    { "sse2", avivo_blit_has_sse2, avivo_blit_row_sse2,
+      avivo_blit_fence_sse2, avivo_blit_hash_c },
+#endif
+    { "c", avivo_blit_always, avivo_blit_row_c, NULL, avivo_blit_hash_c },
+};
+
+/*
+ * The named copy if this CPU can run it, the best one for NULL or
+ * "auto".  NULL for an unknown or unsupported name.
+ */
+const struct avivo_blit *
+avivo_blit_find(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(avivo_blits) / sizeof(avivo_blits[0]); i++) {
+        if (name && strcmp(name, "auto") &&
+            strcmp(name, avivo_blits[i].name))
+            continue;
+        if (avivo_blits[i].supported())
+            return &avivo_blits[i];
+        if (name && strcmp(name, "auto"))
+            return NULL;
+    }
+    return NULL;
+}
+
+/*
+ * Copy the box [x1, x2[ x [y1, y2[ from src to dst, both pitch bytes
+ * wide and aligned alike.  Returns the bytes written.
+ */
+unsigned long
+avivo_blit_box(const struct avivo_blit *blit,
+               unsigned char *dst, const unsigned char *src,
+               int pitch, int cpp, int x1, int y1, int x2, int y2)
+{
+    int start, end, bytes, y;
+    unsigned long offset;
+
+    if (x1 >= x2 || y1 >= y2)
+        return 0;
+    start = (x1 * cpp) & ~(AVIVO_BLIT_ALIGN - 1);
+    end = (x2 * cpp + AVIVO_BLIT_ALIGN - 1) & ~(AVIVO_BLIT_ALIGN - 1);
+    if (end > pitch)
+        end = pitch;
+    bytes = end - start;
+    offset = (unsigned long)y1 * pitch + start;
+    for (y = y1; y < y2; y++, offset += pitch)
+        blit->row(dst + offset, src + offset, bytes);
+    if (blit->fence)
+        blit->fence();
+    return (unsigned long)bytes * (y2 - y1);
+}
+
+/* copy the part of every box that falls in rows [y1, y2[ */
+unsigned long
+avivo_blit_band(const struct avivo_blit_job *job, int y1, int y2)
+{
+    const short *box = job->boxes;
+    unsigned long bytes = 0;
+    int i;
+
+    for (i = 0; i < job->nbox; i++, box += 4)
+        bytes += avivo_blit_box(job->blit, job->dst, job->src,
+                                job->pitch, job->cpp, box[0],
+                                box[1] > y1 ? box[1] : y1, box[2],
+                                box[3] < y2 ? box[3] : y2);
+    return bytes;
+}
+
+/* band i of n over [y1, y2[ */
+static void
+avivo_blit_band_rows(int y1, int y2, int i, int n, int *start, int *end)
+{
+    *start = y1 + (y2 - y1) * i / n;
+    *end = y1 + (y2 - y1) * (i + 1) / n;
+}
+
+static void *
+avivo_blit_worker_main(void *data)
+{
+    struct avivo_blit_worker *worker = data;
+    struct avivo_blit_pool *pool = worker->pool;
+    unsigned long generation = 0, bytes;
+    int y1, y2;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == generation)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        generation = pool->generation;
+        avivo_blit_band_rows(pool->y1, pool->y2, worker->index,
+                             pool->threads, &y1, &y2);
+        pthread_mutex_unlock(&pool->lock);
+
+        bytes = avivo_blit_band(pool->job, y1, y2);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->bytes[worker->index] = bytes;
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+ * Start threads - 1 workers; they block every signal so the server's
+ * handlers keep running on the main thread.  Returns the number of
+ * threads the pool ended up with, 1 if none could be started.
+ */
+int
+avivo_blit_pool_init(struct avivo_blit_pool *pool, int threads)
+{
+    sigset_t all, old;
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->threads = 1;
+    if (threads > AVIVO_BLIT_MAX_THREADS)
+        threads = AVIVO_BLIT_MAX_THREADS;
+    if (threads <= 1)
+        return 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 1; i < threads; i++) {
+        pool->worker[i].pool = pool;
+        pool->worker[i].index = i;
+        if (pthread_create(&pool->worker[i].thread, NULL,
+                           avivo_blit_worker_main, &pool->worker[i]))
+            break;
+        pool->threads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (pool->threads == 1) {
+        pthread_cond_destroy(&pool->done);
+        pthread_cond_destroy(&pool->start);
+        pthread_mutex_destroy(&pool->lock);
+    }
+    return pool->threads;
+}
+
+void
+avivo_blit_pool_fini(struct avivo_blit_pool *pool)
+{
+    int i;
+
+    if (pool->threads <= 1)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->threads; i++)
+        pthread_join(pool->worker[i].thread, NULL);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pool->threads = 1;
+}
+
+/*
+ * Copy a job, in bands over the pool if it is worth it, and return
+ * once every band is done.  *banded tells which way it went.  Returns
+ * the bytes written.
+ */
+unsigned long
+avivo_blit_run(struct avivo_blit_pool *pool, const struct avivo_blit_job *job,
+               int *banded)
+{
+    const short *box = job->boxes;
+    unsigned long area = 0, bytes;
+    int i, y1 = 0x7fff, y2 = 0, band1, band2;
+
+    for (i = 0; i < job->nbox; i++, box += 4) {
+        area += (unsigned long)(box[2] - box[0]) * (box[3] - box[1]);
+        if (box[1] < y1)
+            y1 = box[1];
+        if (box[3] > y2)
+            y2 = box[3];
+    }
+    *banded = pool && pool->threads > 1 && y2 - y1 >= pool->threads &&
+              area * job->cpp >= AVIVO_BLIT_BAND_MIN_BYTES;
+    if (!*banded)
+        return avivo_blit_band(job, 0, 0x7fff);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->y1 = y1;
+    pool->y2 = y2;
+    pool->running = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    avivo_blit_band_rows(y1, y2, 0, pool->threads, &band1, &band2);
+    bytes = avivo_blit_band(job, band1, band2);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    for (i = 1; i < pool->threads; i++)
+        bytes += pool->bytes[i];
+    pthread_mutex_unlock(&pool->lock);
+    return bytes;
+}
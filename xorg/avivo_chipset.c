@@ -653,3 +653,26 @@ avivo_get_chipset(struct avivo_info *avivo)
     FatalError("Unknown chipset for %x!\n", avivo->pci_info->device);
 #endif /*PCIACCESS*/
 }
+
+/*
+ * Largest screen the family can scan out.  Discrete parts are limited
+ * by the 13 bit crtc fields; the IGPs have a smaller line buffer and
+ * share system memory, keep them at 4096.
+ */
+void
+avivo_get_max_size(struct avivo_info *avivo, int *width, int *height)
+{
+    switch (avivo->chipset) {
+    case CHIP_FAMILY_RS600:
+    case CHIP_FAMILY_RS600M:
+    case CHIP_FAMILY_RS690:
+    case CHIP_FAMILY_RS690M:
+        *width = AVIVO_IGP_MAX_SIZE;
+        *height = AVIVO_IGP_MAX_SIZE;
+        break;
+    default:
+        *width = AVIVO_MAX_SIZE;
+        *height = AVIVO_MAX_SIZE;
+        break;
+    }
+}
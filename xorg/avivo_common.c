@@ -27,10 +27,55 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include <string.h>
+#include <time.h>
 
 #include "avivo.h"
 #include "radeon_reg.h"
 
+/*
+ * Point an index register at offset, unless it already is.  Only the
+ * driver writes index registers while we own the VT, anything else
+ * must call avivo_index_invalidate().
+ */
+static void
+avivo_index_select(struct avivo_info *avivo,
+                   unsigned int index_offset,
+                   unsigned int offset)
+{
+    struct avivo_index_cache *cache = &avivo->index_cache;
+    int i;
+
+    for (i = 0; i < cache->count; i++) {
+        if (cache->index_reg[i] == index_offset)
+            break;
+    }
+    if (i < cache->count && cache->valid[i] && cache->value[i] == offset) {
+        cache->writes_avoided++;
+        return;
+    }
+
+    OUTREG(index_offset, offset);
+    if (i == cache->count) {
+        if (cache->count == AVIVO_INDEX_CACHE_SIZE)
+            return;
+        cache->index_reg[i] = index_offset;
+        cache->count++;
+    }
+    cache->value[i] = offset;
+    cache->valid[i] = TRUE;
+}
+
+void
+avivo_index_invalidate(struct avivo_info *avivo)
+{
+    struct avivo_index_cache *cache = &avivo->index_cache;
+    int i;
+
+    for (i = 0; i < cache->count; i++)
+        cache->valid[i] = FALSE;
+}
+
 void
 avivo_set_indexed(ScrnInfoPtr screen_info,
                   unsigned int index_offset,
@@ -40,7 +85,7 @@ avivo_set_indexed(ScrnInfoPtr screen_info,
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
 
-    OUTREG(index_offset, offset);
+    avivo_index_select(avivo, index_offset, offset);
     OUTREG(data_offset, value);
 }
 
@@ -52,7 +97,7 @@ avivo_get_indexed(ScrnInfoPtr screen_info,
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
 
-    OUTREG(index_offset, offset);
+    avivo_index_select(avivo, index_offset, offset);
     return INREG(data_offset);
 }
 
@@ -77,6 +122,33 @@ avivo_set_mc(ScrnInfoPtr screen_info,
                       value);
 }
 
+/* read count consecutive MC registers starting at offset */
+void
+avivo_get_mc_range(ScrnInfoPtr screen_info,
+                   unsigned int offset,
+                   int count,
+                   unsigned int *values)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        avivo_index_select(avivo, AVIVO_MC_INDEX,
+                           (offset + i) | 0x007f0000);
+        values[i] = INREG(AVIVO_MC_DATA);
+    }
+}
+
+/* monotonic time in microseconds, for timeouts and timing logs */
+unsigned long
+avivo_get_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
 struct avivo_info *
 avivo_get_info(ScrnInfoPtr screen_info)
 {
@@ -84,6 +156,11 @@ avivo_get_info(ScrnInfoPtr screen_info)
 
     if (!screen_info->driverPrivate) {
         screen_info->driverPrivate = xcalloc(sizeof(struct avivo_info), 1);
+        avivo = screen_info->driverPrivate;
+        if (avivo) {
+            avivo->scrn_index = screen_info->scrnIndex;
+            avivo->idle.timeout_usec = AVIVO_IDLE_TIMEOUT * 1000;
+        }
     }
 
     avivo = screen_info->driverPrivate;
@@ -92,3 +169,248 @@ avivo_get_info(ScrnInfoPtr screen_info)
 
     return avivo;
 }
+
+/*
+ * Register write queue.
+ *
+ * A mode set touches a few dozen registers and only the final value of
+ * each one matters, so the crtc code queues them between
+ * avivo_queue_begin() and avivo_queue_flush().  A second write to a
+ * register already in the queue drops the pending one and goes to the
+ * tail, so nothing is written earlier than the code asked for, and the
+ * flush emits the writes in queue order followed by at most one idle
+ * wait.  Anything that relies on several writes to the same register
+ * (PLL reset toggles, ...) must keep using OUTREG directly.
+ */
+void
+avivo_queue_begin(struct avivo_info *avivo)
+{
+    struct avivo_reg_queue *queue = &avivo->reg_queue;
+
+    /* already queueing, e.g. several crtcs going out together */
+    if (queue->active)
+        return;
+    queue->active = TRUE;
+    queue->wait_idle = FALSE;
+    queue->overflow = FALSE;
+    queue->count = 0;
+}
+
+static void
+avivo_queue_emit(struct avivo_info *avivo)
+{
+    struct avivo_reg_queue *queue = &avivo->reg_queue;
+    int i;
+
+    for (i = 0; i < queue->count; i++)
+        OUTREG(queue->writes[i].reg, queue->writes[i].value);
+    queue->count = 0;
+}
+
+void
+avivo_queue_reg(struct avivo_info *avivo,
+                unsigned int reg,
+                unsigned int value)
+{
+    struct avivo_reg_queue *queue = &avivo->reg_queue;
+    int i;
+
+    if (!queue->active) {
+        OUTREG(reg, value);
+        return;
+    }
+
+    for (i = 0; i < queue->count; i++) {
+        if (queue->writes[i].reg == reg) {
+            queue->count--;
+            memmove(&queue->writes[i], &queue->writes[i + 1],
+                    (queue->count - i) * sizeof(queue->writes[0]));
+            break;
+        }
+    }
+
+    /*
+     * Queue is full.  Writing out what we have would put half a mode
+     * on the chip before it was validated and outside the update
+     * locks, so drop the lot at the flush instead.
+     */
+    if (queue->count == AVIVO_REG_QUEUE_SIZE) {
+        queue->overflow = TRUE;
+        return;
+    }
+
+    queue->writes[queue->count].reg = reg;
+    queue->writes[queue->count].value = value;
+    queue->count++;
+}
+
+/*
+ * Read a register as it will be once the queue is flushed, without
+ * touching the hardware if the value is still pending.
+ */
+unsigned int
+avivo_queue_read(struct avivo_info *avivo, unsigned int reg)
+{
+    struct avivo_reg_queue *queue = &avivo->reg_queue;
+    int i;
+
+    if (queue->active) {
+        for (i = 0; i < queue->count; i++) {
+            if (queue->writes[i].reg == reg)
+                return queue->writes[i].value;
+        }
+    }
+    return INREG(reg);
+}
+
+void
+avivo_queue_wait_idle(struct avivo_info *avivo)
+{
+    struct avivo_reg_queue *queue = &avivo->reg_queue;
+
+    if (queue->active)
+        queue->wait_idle = TRUE;
+    else
+        avivo_wait_idle(avivo);
+}
+
+Bool
+avivo_queue_flush(struct avivo_info *avivo)
+{
+    struct avivo_reg_queue *queue = &avivo->reg_queue;
+
+    if (queue->overflow) {
+        xf86DrvMsg(avivo->scrn_index, X_ERROR,
+                   "more than %d queued registers, nothing written\n",
+                   AVIVO_REG_QUEUE_SIZE);
+        avivo_queue_cancel(avivo);
+        return FALSE;
+    }
+    avivo_queue_emit(avivo);
+    queue->active = FALSE;
+    if (queue->wait_idle) {
+        queue->wait_idle = FALSE;
+        return avivo_wait_idle(avivo);
+    }
+    return TRUE;
+}
+
+/* Drop whatever is still queued, nothing reaches the hardware. */
+void
+avivo_queue_cancel(struct avivo_info *avivo)
+{
+    struct avivo_reg_queue *queue = &avivo->reg_queue;
+
+    queue->count = 0;
+    queue->active = FALSE;
+    queue->wait_idle = FALSE;
+    queue->overflow = FALSE;
+}
+
+/*
+ * Register shadow.
+ *
+ * Registers the driver owns are mirrored in avivo->reg_shadow so that
+ * read-modify-write sequences on the cursor hot path don't have to go
+ * through an uncached MMIO read.  Each register gets a policy:
+ *  - cached: reads come from the shadow once we know the value,
+ *  - volatile: the hardware changes it behind our back, always read it
+ *    and never remember what we wrote,
+ *  - write only: reading it back is pointless, hand out what we wrote;
+ *    until we have written it there is only the hardware to ask.
+ * Registers not listed here go straight to the hardware.  The card lock
+ * is shared with whoever else drives the card and is never listed.  The
+ * shadow is dropped whenever someone else may have touched the hardware
+ * (VT switch, state restore).
+ */
+static const struct {
+    unsigned int reg;
+    enum avivo_reg_policy policy;
+} avivo_shadow_regs[] = {
+    { AVIVO_CURSOR1_CNTL,                           AVIVO_REG_CACHED },
+    { AVIVO_CURSOR1_CNTL + AVIVO_CRTC2_OFFSET,      AVIVO_REG_CACHED },
+    { AVIVO_CURSOR1_POSITION,                       AVIVO_REG_WRITE_ONLY },
+    { AVIVO_CURSOR1_POSITION + AVIVO_CRTC2_OFFSET,  AVIVO_REG_WRITE_ONLY },
+    { AVIVO_TMDSA_CNTL,                             AVIVO_REG_CACHED },
+    { AVIVO_LVTMA_CNTL,                             AVIVO_REG_CACHED },
+    /* surface update pending, set and cleared by the chip */
+    { AVIVO_CRTC1_GRPH_UPDATE,                      AVIVO_REG_VOLATILE },
+    { AVIVO_CRTC1_GRPH_UPDATE + AVIVO_CRTC2_OFFSET, AVIVO_REG_VOLATILE },
+    /* panel power sequencer progress */
+    { AVIVO_LVTMA_PWRSEQ_STATE,                     AVIVO_REG_VOLATILE },
+};
+
+#define AVIVO_NUM_SHADOW_REGS \
+    (sizeof(avivo_shadow_regs) / sizeof(avivo_shadow_regs[0]))
+
+/* fails to compile if the table outgrows struct avivo_reg_shadow */
+typedef char avivo_shadow_regs_fit[AVIVO_NUM_SHADOW_REGS <=
+                                   AVIVO_REG_SHADOW_SIZE ? 1 : -1];
+
+static int
+avivo_reg_shadow_slot(unsigned int reg)
+{
+    int i;
+
+    for (i = 0; i < AVIVO_NUM_SHADOW_REGS; i++) {
+        if (avivo_shadow_regs[i].reg == reg)
+            return i;
+    }
+    return -1;
+}
+
+unsigned int
+avivo_reg_read(struct avivo_info *avivo, unsigned int reg)
+{
+    struct avivo_reg_shadow *shadow = &avivo->reg_shadow;
+    int slot = avivo_reg_shadow_slot(reg);
+
+    if (slot >= 0 && avivo_shadow_regs[slot].policy != AVIVO_REG_VOLATILE) {
+        if (shadow->valid[slot]) {
+            shadow->reads_avoided++;
+            return shadow->value[slot];
+        }
+        /* what a write only register reads back is no value to keep */
+        shadow->value[slot] = INREG(reg);
+        shadow->valid[slot] =
+            avivo_shadow_regs[slot].policy == AVIVO_REG_CACHED;
+        shadow->reads++;
+        return shadow->value[slot];
+    }
+    shadow->reads++;
+    return INREG(reg);
+}
+
+void
+avivo_reg_write(struct avivo_info *avivo,
+                unsigned int reg,
+                unsigned int value)
+{
+    struct avivo_reg_shadow *shadow = &avivo->reg_shadow;
+    int slot = avivo_reg_shadow_slot(reg);
+
+    OUTREG(reg, value);
+    if (slot >= 0 && avivo_shadow_regs[slot].policy != AVIVO_REG_VOLATILE) {
+        shadow->value[slot] = value;
+        shadow->valid[slot] = TRUE;
+    }
+}
+
+void
+avivo_reg_rmw(struct avivo_info *avivo,
+              unsigned int reg,
+              unsigned int clear,
+              unsigned int set)
+{
+    avivo_reg_write(avivo, reg, (avivo_reg_read(avivo, reg) & ~clear) | set);
+}
+
+void
+avivo_reg_shadow_invalidate(struct avivo_info *avivo)
+{
+    struct avivo_reg_shadow *shadow = &avivo->reg_shadow;
+    int i;
+
+    for (i = 0; i < AVIVO_REG_SHADOW_SIZE; i++)
+        shadow->valid[i] = FALSE;
+}
@@ -28,6 +28,7 @@
 /* DPMS */
 #define DPMS_SERVER
 #include <X11/extensions/dpms.h>
+#include "xf86Cursor.h"
 
 #include "avivo.h"
 #include "radeon_reg.h"
@@ -61,7 +62,10 @@ avivo_crtc_enable(xf86CrtcPtr crtc, int enable)
     
     OUTREG(AVIVO_CRTC1_SCAN_ENABLE + avivo_crtc->crtc_offset, scan_enable);
     OUTREG(AVIVO_CRTC1_CNTL + avivo_crtc->crtc_offset, cntl);
-    avivo_wait_idle(avivo);
+    if (!avivo_wait_idle(avivo))
+        xf86DrvMsg(crtc->scrn->scrnIndex, X_WARNING,
+                   "crtc %d: %s didn't complete\n", avivo_crtc->crtc_number,
+                   enable ? "enable" : "disable");
 }
 
 static void
@@ -102,7 +106,18 @@ avivo_crtc_mode_fixup(xf86CrtcPtr crtc,
                       DisplayModePtr mode,
                       DisplayModePtr adjusted_mode)
 {
-    /* maybe we should do some sanity check here */
+    ScrnInfoPtr screen_info = crtc->scrn;
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+
+    /* refuse now rather than leave a half programmed crtc behind; this
+     * also leaves the dividers in the cache for mode_set */
+    if (avivo_mode_validate(screen_info, adjusted_mode) != MODE_OK)
+        return FALSE;
+    if (!avivo_mode_bandwidth_ok(crtc, adjusted_mode))
+        return FALSE;
+    if (screen_info->displayWidth * screen_info->virtualY *
+        (screen_info->bitsPerPixel / 8) > avivo->fb_size)
+        return FALSE;
     return TRUE;
 }
 
@@ -114,203 +129,618 @@ avivo_crtc_prepare(xf86CrtcPtr crtc)
 }
 
 static void
-avivo_crtc_set_pll(xf86CrtcPtr crtc, DisplayModePtr mode)
+avivo_crtc_set_pll(xf86CrtcPtr crtc, DisplayModePtr mode,
+                   const struct avivo_pll *new_pll)
 {
     struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
     struct avivo_info *avivo = avivo_get_info(crtc->scrn);
-	double c;
-	int div1, div2, clock;
-	int sdiv1, sdiv2, smul, sclock;
-	int mul;
-
-	c = (((double)mode->Clock) * 40.0) / 1080000.0;
-	clock = mode->Clock;
-	sdiv1 = 0;
-	sdiv2 = 0;
-	smul  = 0;
-    for (div1 = 2; div1 <= 6; div1++) {
-        for (div2 = div1 + 1; div2 < (div1 + 14); div2++) {
-            mul = ceil(c * div1 * div2);
-            clock = (mul * 1080000) / (40 * div1 * div2);
-            if ((div1 * div2) > 20 && (clock - mode->Clock) >= 0 &&
-                fabsl(sclock - mode->Clock) >= fabsl(clock - mode->Clock) &&
-                mul < 256 && (div1 * div2) > (sdiv1 * sdiv2)) {
-                sdiv1  = div1;
-                sdiv2  = div2;
-                smul   = mul;
-                sclock = clock;
-            }
-        }
+    struct avivo_pll pll = *new_pll;
+    int sdiv1, sdiv2, smul;
+
+    /* same dividers, leave the PLL locked; the cache only changes
+     * once avivo_crtc_apply() got the writes out */
+    if (avivo_crtc->pll_valid && avivo_crtc->pll.post_div == pll.post_div &&
+        avivo_crtc->pll.div == pll.div && avivo_crtc->pll.mul == pll.mul) {
+        xf86DrvMsgVerb(crtc->scrn->scrnIndex, X_INFO, 5,
+                       "crtc(%d) PLL unchanged at %d kHz\n",
+                       avivo_crtc->crtc_number, pll.clock);
+        return;
     }
+    sdiv1 = pll.post_div;
+    sdiv2 = pll.div;
+    smul = pll.mul;
     xf86DrvMsg(crtc->scrn->scrnIndex, X_INFO,
-               "crtc(%d) Clock: mode %d, PLL %d\n",
-               avivo_crtc->crtc_number, mode->Clock, sclock);
+               "crtc(%d) Clock: mode %d, PLL %d (%d ppm)\n",
+               avivo_crtc->crtc_number, mode->Clock, pll.clock, pll.ppm);
     xf86DrvMsg(crtc->scrn->scrnIndex, X_INFO,
                "crtc(%d) PLL  : div %d, pmul 0x%X(%d), pdiv %d\n",
                avivo_crtc->crtc_number, sdiv1, smul, smul, sdiv2);
     switch (avivo_crtc->crtc_number) {
     case 0:
-        OUTREG(AVIVO_PLL1_POST_DIV_CNTL, AVIVO_PLL_POST_DIV_EN);
-        OUTREG(AVIVO_PLL1_POST_DIV_MYSTERY, AVIVO_PLL_POST_DIV_MYSTERY_VALUE);
-        OUTREG(AVIVO_PLL1_POST_DIV, sdiv1);
-        OUTREG(AVIVO_PLL1_POST_MUL, (smul << AVIVO_PLL_POST_MUL_SHIFT));
-        OUTREG(AVIVO_PLL1_DIVIDER_CNTL, AVIVO_PLL_DIVIDER_EN);
-        OUTREG(AVIVO_PLL1_DIVIDER, sdiv2);
-        OUTREG(AVIVO_PLL1_MYSTERY0, AVIVO_PLL_MYSTERY0_VALUE);
-        OUTREG(AVIVO_PLL1_MYSTERY1, AVIVO_PLL_MYSTERY1_VALUE);
+        QOUTREG(AVIVO_PLL1_POST_DIV_CNTL, AVIVO_PLL_POST_DIV_EN);
+        QOUTREG(AVIVO_PLL1_POST_DIV_MYSTERY, AVIVO_PLL_POST_DIV_MYSTERY_VALUE);
+        QOUTREG(AVIVO_PLL1_POST_DIV, sdiv1);
+        QOUTREG(AVIVO_PLL1_POST_MUL, (smul << AVIVO_PLL_POST_MUL_SHIFT));
+        QOUTREG(AVIVO_PLL1_DIVIDER_CNTL, AVIVO_PLL_DIVIDER_EN);
+        QOUTREG(AVIVO_PLL1_DIVIDER, sdiv2);
+        QOUTREG(AVIVO_PLL1_MYSTERY0, AVIVO_PLL_MYSTERY0_VALUE);
+        QOUTREG(AVIVO_PLL1_MYSTERY1, AVIVO_PLL_MYSTERY1_VALUE);
         break;
     case 1:
-        OUTREG(AVIVO_PLL2_POST_DIV_CNTL, AVIVO_PLL_POST_DIV_EN);
-        OUTREG(AVIVO_PLL2_POST_DIV_MYSTERY, AVIVO_PLL_POST_DIV_MYSTERY_VALUE);
-        OUTREG(AVIVO_PLL2_POST_DIV, sdiv1);
-        OUTREG(AVIVO_PLL2_POST_MUL, (smul << AVIVO_PLL_POST_MUL_SHIFT));
-        OUTREG(AVIVO_PLL2_DIVIDER_CNTL, AVIVO_PLL_DIVIDER_EN);
-        OUTREG(AVIVO_PLL2_DIVIDER, sdiv2);
-        OUTREG(AVIVO_PLL2_MYSTERY0, AVIVO_PLL_MYSTERY0_VALUE);
-        OUTREG(AVIVO_PLL2_MYSTERY1, AVIVO_PLL_MYSTERY1_VALUE);
+        QOUTREG(AVIVO_PLL2_POST_DIV_CNTL, AVIVO_PLL_POST_DIV_EN);
+        QOUTREG(AVIVO_PLL2_POST_DIV_MYSTERY, AVIVO_PLL_POST_DIV_MYSTERY_VALUE);
+        QOUTREG(AVIVO_PLL2_POST_DIV, sdiv1);
+        QOUTREG(AVIVO_PLL2_POST_MUL, (smul << AVIVO_PLL_POST_MUL_SHIFT));
+        QOUTREG(AVIVO_PLL2_DIVIDER_CNTL, AVIVO_PLL_DIVIDER_EN);
+        QOUTREG(AVIVO_PLL2_DIVIDER, sdiv2);
+        QOUTREG(AVIVO_PLL2_MYSTERY0, AVIVO_PLL_MYSTERY0_VALUE);
+        QOUTREG(AVIVO_PLL2_MYSTERY1, AVIVO_PLL_MYSTERY1_VALUE);
         break;
     }
-    OUTREG(AVIVO_CRTC_PLL_SOURCE, (0 << AVIVO_CRTC1_PLL_SOURCE_SHIFT)	
-                                  | (1 << AVIVO_CRTC2_PLL_SOURCE_SHIFT));
-    OUTREG(0x454, INREG(0x454) | 0x2);
-    avivo_wait_idle(avivo);
+    QOUTREG(AVIVO_CRTC_PLL_SOURCE, (0 << AVIVO_CRTC1_PLL_SOURCE_SHIFT)
+                                   | (1 << AVIVO_CRTC2_PLL_SOURCE_SHIFT));
+    QOUTREG(0x454, avivo_queue_read(avivo, 0x454) | 0x2);
+    avivo_queue_wait_idle(avivo);
+}
+
+static unsigned int
+avivo_crtc_offset_end(DisplayModePtr mode, int x, int y)
+{
+    return ((mode->HDisplay + x - 128) << 16) | (mode->VDisplay + y - 128);
 }
 
+/*
+ * Pan the viewport.  Both offsets are written with the graphics update
+ * lock held, the crtc latches them together at its next vblank rather
+ * than mid frame.  A pan that comes before that vblank simply replaces
+ * the one still pending.
+ */
+void
+avivo_crtc_set_base(xf86CrtcPtr crtc, int x, int y)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+    unsigned long offset = avivo_crtc->crtc_offset;
+
+    /* see avivo_crtc_mode_set() */
+    x = x & ~3;
+    OUTREG(AVIVO_CRTC1_GRPH_UPDATE + offset, AVIVO_CRTC_GRPH_UPDATE_LOCK);
+    OUTREG(AVIVO_CRTC1_OFFSET_START + offset, (x << 16) | y);
+    OUTREG(AVIVO_CRTC1_OFFSET_END + offset,
+           avivo_crtc_offset_end(&crtc->mode, x, y));
+    OUTREG(AVIVO_CRTC1_GRPH_UPDATE + offset, 0);
+}
+
+/*
+ * Line buffer split and display priorities depend on both heads, so
+ * they are recomputed for both whenever one changes mode.
+ */
 static void
-avivo_crtc_mode_set(xf86CrtcPtr crtc,
-                   DisplayModePtr mode,
-                   DisplayModePtr adjusted_mode,
-                   int x, int y)
+avivo_crtc_set_watermarks(xf86CrtcPtr crtc, DisplayModePtr mode)
+{
+    ScrnInfoPtr screen_info = crtc->scrn;
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_wm_params params;
+    struct avivo_wm wm;
+    int i;
+
+    memset(&params, 0, sizeof(params));
+    params.mclk = avivo->mclk;
+    for (i = 0; i < config->num_crtc && i < 2; i++) {
+        xf86CrtcPtr other = config->crtc[i];
+        struct avivo_crtc_private *avivo_crtc = other->driver_private;
+        struct avivo_wm_head *head = &params.head[avivo_crtc->crtc_number];
+
+        if (other == crtc)
+            avivo_mode_wm_head(screen_info, mode, head);
+        else if (other->enabled)
+            avivo_mode_wm_head(screen_info, &other->mode, head);
+    }
+    if (!avivo_wm_compute(&params, &wm))
+        xf86DrvMsg(screen_info->scrnIndex, X_WARNING,
+                   "scanout needs %d kB/s, memory gives %d kB/s\n",
+                   wm.demand, wm.available);
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "watermarks: lb split %u, priority 0x%x 0x%x\n",
+               wm.lb_split, wm.priority[0], wm.priority[1]);
+
+    avivo->wm = wm;
+    QOUTREG(AVIVO_DC_LB_MEMORY_SPLIT,
+            (avivo_queue_read(avivo, AVIVO_DC_LB_MEMORY_SPLIT) &
+             ~AVIVO_DC_LB_MEMORY_SPLIT_MASK) | wm.lb_split);
+    QOUTREG(AVIVO_CRTC1_PRIORITY_A_CNT, wm.priority[0]);
+    QOUTREG(AVIVO_CRTC1_PRIORITY_B_CNT, wm.priority_b[0]);
+    QOUTREG(AVIVO_CRTC2_PRIORITY_A_CNT, wm.priority[1]);
+    QOUTREG(AVIVO_CRTC2_PRIORITY_B_CNT, wm.priority_b[1]);
+}
+
+static void
+avivo_crtc_image_compute(xf86CrtcPtr crtc, DisplayModePtr adjusted_mode,
+                         struct avivo_crtc_image *image)
 {
     ScrnInfoPtr screen_info = crtc->scrn;
     struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
-    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
-    unsigned long fb_location = avivo_crtc->fb_offset + avivo->fb_addr;
-    int regval;
+    struct avivo_info *avivo = avivo_get_info(screen_info);
 
     /* compute mode value
      * TODO: hsync & vsync pol likely not handled properly
      */
-    avivo_crtc->h_total = adjusted_mode->HTotal - 1;
-    avivo_crtc->h_blank =
+    image->h_total = adjusted_mode->HTotal - 1;
+    image->h_blank =
         ((adjusted_mode->CrtcHTotal - adjusted_mode->CrtcHSyncStart) << 16)
         | (adjusted_mode->CrtcHTotal - adjusted_mode->CrtcHSyncStart
            + adjusted_mode->CrtcHDisplay);
-    avivo_crtc->h_sync_wid = (adjusted_mode->CrtcHSyncEnd
-                              - adjusted_mode->CrtcHSyncStart) << 16;
-    avivo_crtc->h_sync_pol = (adjusted_mode->Flags & V_NHSYNC) ? 1 : 0;
-    avivo_crtc->v_total = adjusted_mode->CrtcVTotal - 1;
-    avivo_crtc->v_blank =
+    image->h_sync_wid = (adjusted_mode->CrtcHSyncEnd
+                         - adjusted_mode->CrtcHSyncStart) << 16;
+    image->h_sync_pol = (adjusted_mode->Flags & V_NHSYNC) ? 1 : 0;
+    image->v_total = adjusted_mode->CrtcVTotal - 1;
+    image->v_blank =
         ((adjusted_mode->CrtcVTotal - adjusted_mode->CrtcVSyncStart) << 16)
         | (adjusted_mode->CrtcVTotal - adjusted_mode->CrtcVSyncStart
            + adjusted_mode->CrtcVDisplay);
-    avivo_crtc->v_sync_wid = (adjusted_mode->CrtcVSyncEnd
-                              - adjusted_mode->CrtcVSyncStart) << 16;
-    avivo_crtc->v_sync_pol = (adjusted_mode->Flags & V_NVSYNC) ? 1 : 0;
-    avivo_crtc->fb_width = adjusted_mode->CrtcHDisplay;
-    avivo_crtc->fb_height = screen_info->virtualY;
-    avivo_crtc->fb_pitch = adjusted_mode->CrtcHDisplay;
-    avivo_crtc->fb_offset = 0;
-    avivo_crtc->fb_length = avivo_crtc->fb_pitch * avivo_crtc->fb_height * 4;
+    image->v_sync_wid = (adjusted_mode->CrtcVSyncEnd
+                         - adjusted_mode->CrtcVSyncStart) << 16;
+    image->v_sync_pol = (adjusted_mode->Flags & V_NVSYNC) ? 1 : 0;
+    image->fb_width = adjusted_mode->CrtcHDisplay;
+    image->fb_height = screen_info->virtualY;
+    image->fb_pitch = adjusted_mode->CrtcHDisplay;
+    image->fb_length = image->fb_pitch * image->fb_height * 4;
     switch (crtc->scrn->bitsPerPixel) {
     case 15:
-        avivo_crtc->fb_format = AVIVO_CRTC_FORMAT_ARGB15;
+        image->fb_format = AVIVO_CRTC_FORMAT_ARGB15;
         break;
     case 16:
-        avivo_crtc->fb_format = AVIVO_CRTC_FORMAT_ARGB16;
+        image->fb_format = AVIVO_CRTC_FORMAT_ARGB16;
         break;
     case 24:
     case 32:
-        avivo_crtc->fb_format = AVIVO_CRTC_FORMAT_ARGB32;
+        image->fb_format = AVIVO_CRTC_FORMAT_ARGB32;
         break;
     default:
         FatalError("Unsupported screen depth: %d\n", xf86GetDepth());
     }
+    avivo_pll_cache_get(&avivo->pll_cache, adjusted_mode->Clock, &image->pll);
     xf86DrvMsg(crtc->scrn->scrnIndex, X_INFO,
                "crtc(%d) hdisp %d, htotal %d, hss %d, hse %d, hsk %d, hsp %d\n",
                avivo_crtc->crtc_number, adjusted_mode->CrtcHDisplay,
                adjusted_mode->CrtcHTotal, adjusted_mode->CrtcHSyncStart,
                adjusted_mode->CrtcHSyncEnd, adjusted_mode->CrtcHSkew,
-               avivo_crtc->h_sync_pol);
+               image->h_sync_pol);
     xf86DrvMsg(crtc->scrn->scrnIndex, X_INFO,
                "crtc(%d) vdisp %d, vtotal %d, vss %d, vse %d, vsc %d, vsp %d\n",
                avivo_crtc->crtc_number, adjusted_mode->CrtcVDisplay,
                adjusted_mode->CrtcVTotal, adjusted_mode->CrtcVSyncStart,
                adjusted_mode->CrtcVSyncEnd, adjusted_mode->VScan,
-               avivo_crtc->v_sync_pol);
+               image->v_sync_pol);
+}
+
+/*
+ * The computed image for a mode: the cached one if this crtc set it
+ * recently, else computed into the least recently used slot.
+ */
+static struct avivo_crtc_image *
+avivo_crtc_image_get(xf86CrtcPtr crtc, DisplayModePtr mode,
+                     DisplayModePtr adjusted_mode)
+{
+    ScrnInfoPtr screen_info = crtc->scrn;
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_crtc_image *image, *victim = NULL;
+    int key[AVIVO_CRTC_IMAGE_KEY_SIZE];
+    int i;
+
+    avivo_mode_key(adjusted_mode, key);
+    key[AVIVO_MODE_KEY_SIZE] = mode->HDisplay;
+    key[AVIVO_MODE_KEY_SIZE + 1] = mode->VDisplay;
+    key[AVIVO_MODE_KEY_SIZE + 2] = screen_info->virtualX;
+    key[AVIVO_MODE_KEY_SIZE + 3] = screen_info->virtualY;
+    key[AVIVO_MODE_KEY_SIZE + 4] = screen_info->displayWidth;
+    key[AVIVO_MODE_KEY_SIZE + 5] = screen_info->bitsPerPixel;
+
+    avivo_crtc->image_stamp++;
+    for (i = 0; i < AVIVO_CRTC_IMAGE_CACHE_SIZE; i++) {
+        image = &avivo_crtc->image[i];
+        if (image->valid && !memcmp(image->key, key, sizeof(key))) {
+            avivo_crtc->image_hits++;
+            image->stamp = avivo_crtc->image_stamp;
+            xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                       "crtc(%d) reusing %dx%d image\n",
+                       avivo_crtc->crtc_number, mode->HDisplay,
+                       mode->VDisplay);
+            return image;
+        }
+        if (victim == NULL || !image->valid ||
+            (victim->valid && image->stamp < victim->stamp))
+            victim = image;
+    }
+
+    avivo_crtc->image_misses++;
+    avivo_crtc_image_compute(crtc, adjusted_mode, victim);
+    memcpy(victim->key, key, sizeof(key));
+    victim->valid = TRUE;
+    victim->stamp = avivo_crtc->image_stamp;
+    return victim;
+}
+
+void
+avivo_crtc_dump_stats(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    int i;
+
+    for (i = 0; i < config->num_crtc; i++) {
+        avivo_crtc = config->crtc[i]->driver_private;
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "crtc(%d) mode images: %lu reused, %lu computed\n",
+                   avivo_crtc->crtc_number, avivo_crtc->image_hits,
+                   avivo_crtc->image_misses);
+    }
+}
+
+static void
+avivo_crtc_mode_set(xf86CrtcPtr crtc,
+                   DisplayModePtr mode,
+                   DisplayModePtr adjusted_mode,
+                   int x, int y)
+{
+    ScrnInfoPtr screen_info = crtc->scrn;
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+    unsigned long fb_location = avivo_crtc->fb_offset + avivo->fb_addr;
+    struct avivo_crtc_image *image;
+    int regval;
+
+#ifdef AVIVO_PAGE_FLIP
+    /* queued flips are for the old mode's buffers */
+    avivo_crtc_flip_cancel(crtc);
+#endif
+    avivo_queue_begin(avivo);
+
+    image = avivo_crtc_image_get(crtc, mode, adjusted_mode);
+    avivo_crtc->h_total = image->h_total;
+    avivo_crtc->h_blank = image->h_blank;
+    avivo_crtc->h_sync_wid = image->h_sync_wid;
+    avivo_crtc->h_sync_pol = image->h_sync_pol;
+    avivo_crtc->v_total = image->v_total;
+    avivo_crtc->v_blank = image->v_blank;
+    avivo_crtc->v_sync_wid = image->v_sync_wid;
+    avivo_crtc->v_sync_pol = image->v_sync_pol;
+    avivo_crtc->pending_pll = image->pll;
+    avivo_crtc->fb_format = image->fb_format;
+    avivo_crtc->fb_length = image->fb_length;
+    avivo_crtc->fb_pitch = image->fb_pitch;
+    avivo_crtc->fb_width = image->fb_width;
+    avivo_crtc->fb_height = image->fb_height;
+    avivo_crtc->fb_offset = 0;
     /* TODO: find out what this regs truely are for.
      * last guess: Switch from text to graphics mode.
      */
 
     regval = (AVIVO_VGA1_CONTROL_SYNC_POLARITY_SELECT | AVIVO_VGA1_CONTROL_OVERSCAN_TIMING_SELECT | AVIVO_VGA1_CONTROL_OVERSCAN_COLOR_EN);
-    OUTREG(AVIVO_VGA1_CONTROL, regval);
+    QOUTREG(AVIVO_VGA1_CONTROL, regval);
     regval = (AVIVO_VGA2_CONTROL_OVERSCAN_TIMING_SELECT);
-    OUTREG(AVIVO_VGA2_CONTROL, regval);
+    QOUTREG(AVIVO_VGA2_CONTROL, regval);
 
     /* setup fb format and location
      */
-    OUTREG(AVIVO_CRTC1_FB_LOCATION + avivo_crtc->crtc_offset, fb_location);
-    OUTREG(AVIVO_CRTC1_FB_FORMAT + avivo_crtc->crtc_offset,
-           avivo_crtc->fb_format);
-    OUTREG(AVIVO_CRTC1_FB_END + avivo_crtc->crtc_offset,
-           fb_location + avivo_crtc->fb_length);
-    OUTREG(AVIVO_CRTC1_BLANK_STATUS + avivo_crtc->crtc_offset, 0);
+    QOUTREG(AVIVO_CRTC1_FB_LOCATION + avivo_crtc->crtc_offset, fb_location);
+    QOUTREG(AVIVO_CRTC1_FB_FORMAT + avivo_crtc->crtc_offset,
+            avivo_crtc->fb_format);
+    QOUTREG(AVIVO_CRTC1_FB_END + avivo_crtc->crtc_offset,
+            fb_location + avivo_crtc->fb_length);
+    QOUTREG(AVIVO_CRTC1_BLANK_STATUS + avivo_crtc->crtc_offset, 0);
     /* avivo can only shift offset by 4 pixel in x if you program somethings
      * not multiple of 4 you gonna drive the GPU crazy and likely won't
      * be able to restore it without cold reboot (vbe post not enough)
      */
     x = x & ~3;
-    OUTREG(AVIVO_CRTC1_OFFSET_END + avivo_crtc->crtc_offset,
-           ((mode->HDisplay + x -128) << 16) | (mode->VDisplay + y - 128));
-    OUTREG(AVIVO_CRTC1_OFFSET_START + avivo_crtc->crtc_offset, (x << 16) | y);
+    QOUTREG(AVIVO_CRTC1_OFFSET_END + avivo_crtc->crtc_offset,
+            avivo_crtc_offset_end(mode, x, y));
+    QOUTREG(AVIVO_CRTC1_OFFSET_START + avivo_crtc->crtc_offset, (x << 16) | y);
 
-    avivo_crtc_set_pll(crtc, adjusted_mode);
+    avivo_crtc_set_pll(crtc, adjusted_mode, &image->pll);
 
     /* finaly set the mode
      */
-    OUTREG(AVIVO_CRTC1_FB_HEIGHT + avivo_crtc->crtc_offset,
-           avivo_crtc->fb_height);
-    OUTREG(AVIVO_CRTC1_EXPANSION_SOURCE + avivo_crtc->crtc_offset,
-           (mode->HDisplay << 16) | mode->VDisplay);
-    OUTREG(AVIVO_CRTC1_EXPANSION_CNTL + avivo_crtc->crtc_offset,
-           AVIVO_CRTC_EXPANSION_EN);
-    OUTREG(AVIVO_CRTC1_6594 + avivo_crtc->crtc_offset, AVIVO_CRTC1_6594_VALUE);
-    OUTREG(AVIVO_CRTC1_659C + avivo_crtc->crtc_offset, AVIVO_CRTC1_659C_VALUE);
-    OUTREG(AVIVO_CRTC1_65A8 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65A8_VALUE);
-    OUTREG(AVIVO_CRTC1_65AC + avivo_crtc->crtc_offset, AVIVO_CRTC1_65AC_VALUE);
-    OUTREG(AVIVO_CRTC1_65B8 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65B8_VALUE);
-    OUTREG(AVIVO_CRTC1_65BC + avivo_crtc->crtc_offset, AVIVO_CRTC1_65BC_VALUE);
-    OUTREG(AVIVO_CRTC1_65C8 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65C8_VALUE);
-    OUTREG(AVIVO_CRTC1_65A4 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65A4_VALUE);
-    OUTREG(AVIVO_CRTC1_65B0 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65B0_VALUE);
-    OUTREG(AVIVO_CRTC1_65C0 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65C0_VALUE);
-
-    OUTREG(AVIVO_CRTC1_X_LENGTH + avivo_crtc->crtc_offset,
-           crtc->scrn->virtualX);
-    OUTREG(AVIVO_CRTC1_Y_LENGTH + avivo_crtc->crtc_offset,
-           crtc->scrn->virtualY);
-    OUTREG(AVIVO_CRTC1_PITCH + avivo_crtc->crtc_offset,
-           crtc->scrn->displayWidth);
-    OUTREG(AVIVO_CRTC1_H_TOTAL + avivo_crtc->crtc_offset, avivo_crtc->h_total);
-    OUTREG(AVIVO_CRTC1_H_BLANK + avivo_crtc->crtc_offset, avivo_crtc->h_blank);
-    OUTREG(AVIVO_CRTC1_H_SYNC_WID + avivo_crtc->crtc_offset,
-           avivo_crtc->h_sync_wid);
-    OUTREG(AVIVO_CRTC1_H_SYNC_POL + avivo_crtc->crtc_offset,
-           avivo_crtc->h_sync_pol);
-    OUTREG(AVIVO_CRTC1_V_TOTAL + avivo_crtc->crtc_offset, avivo_crtc->v_total);
-    OUTREG(AVIVO_CRTC1_V_BLANK + avivo_crtc->crtc_offset, avivo_crtc->v_blank);
-    OUTREG(AVIVO_CRTC1_V_SYNC_WID + avivo_crtc->crtc_offset,
-           avivo_crtc->v_sync_wid);
-    OUTREG(AVIVO_CRTC1_V_SYNC_POL + avivo_crtc->crtc_offset,
-           avivo_crtc->v_sync_pol);
+    QOUTREG(AVIVO_CRTC1_FB_HEIGHT + avivo_crtc->crtc_offset,
+            avivo_crtc->fb_height);
+    QOUTREG(AVIVO_CRTC1_EXPANSION_SOURCE + avivo_crtc->crtc_offset,
+            (mode->HDisplay << 16) | mode->VDisplay);
+    QOUTREG(AVIVO_CRTC1_EXPANSION_CNTL + avivo_crtc->crtc_offset,
+            AVIVO_CRTC_EXPANSION_EN);
+    /*
+     * The rest of the scaler block EXPANSION_CNTL starts: taps and
+     * filters as the BIOS sets them for a 1:1 scale, which is what
+     * EXPANSION_SOURCE asks for, so they don't depend on the mode.
+     * Nothing here is a watermark, those are PRIORITY_A/B_CNT below.
+     */
+    QOUTREG(AVIVO_CRTC1_6594 + avivo_crtc->crtc_offset, AVIVO_CRTC1_6594_VALUE);
+    QOUTREG(AVIVO_CRTC1_659C + avivo_crtc->crtc_offset, AVIVO_CRTC1_659C_VALUE);
+    QOUTREG(AVIVO_CRTC1_65A8 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65A8_VALUE);
+    QOUTREG(AVIVO_CRTC1_65AC + avivo_crtc->crtc_offset, AVIVO_CRTC1_65AC_VALUE);
+    QOUTREG(AVIVO_CRTC1_65B8 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65B8_VALUE);
+    QOUTREG(AVIVO_CRTC1_65BC + avivo_crtc->crtc_offset, AVIVO_CRTC1_65BC_VALUE);
+    QOUTREG(AVIVO_CRTC1_65C8 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65C8_VALUE);
+    QOUTREG(AVIVO_CRTC1_65A4 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65A4_VALUE);
+    QOUTREG(AVIVO_CRTC1_65B0 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65B0_VALUE);
+    QOUTREG(AVIVO_CRTC1_65C0 + avivo_crtc->crtc_offset, AVIVO_CRTC1_65C0_VALUE);
+    avivo_crtc_set_watermarks(crtc, adjusted_mode);
+
+    QOUTREG(AVIVO_CRTC1_X_LENGTH + avivo_crtc->crtc_offset,
+            crtc->scrn->virtualX);
+    QOUTREG(AVIVO_CRTC1_Y_LENGTH + avivo_crtc->crtc_offset,
+            crtc->scrn->virtualY);
+    QOUTREG(AVIVO_CRTC1_PITCH + avivo_crtc->crtc_offset,
+            crtc->scrn->displayWidth);
+    QOUTREG(AVIVO_CRTC1_H_TOTAL + avivo_crtc->crtc_offset, avivo_crtc->h_total);
+    QOUTREG(AVIVO_CRTC1_H_BLANK + avivo_crtc->crtc_offset, avivo_crtc->h_blank);
+    QOUTREG(AVIVO_CRTC1_H_SYNC_WID + avivo_crtc->crtc_offset,
+            avivo_crtc->h_sync_wid);
+    QOUTREG(AVIVO_CRTC1_H_SYNC_POL + avivo_crtc->crtc_offset,
+            avivo_crtc->h_sync_pol);
+    QOUTREG(AVIVO_CRTC1_V_TOTAL + avivo_crtc->crtc_offset, avivo_crtc->v_total);
+    QOUTREG(AVIVO_CRTC1_V_BLANK + avivo_crtc->crtc_offset, avivo_crtc->v_blank);
+    QOUTREG(AVIVO_CRTC1_V_SYNC_WID + avivo_crtc->crtc_offset,
+            avivo_crtc->v_sync_wid);
+    QOUTREG(AVIVO_CRTC1_V_SYNC_POL + avivo_crtc->crtc_offset,
+            avivo_crtc->v_sync_pol);
+
+    /* the image goes out in avivo_crtc_commit, or with every other
+     * crtc's in avivo_crtc_batch_end */
+    avivo_crtc->pending = TRUE;
+}
+
+/*
+ * Write every queued crtc image with the update locks held, so each
+ * crtc latches its new timings and scanout at its next vblank in one
+ * go, then turn the crtcs back on.
+ */
+static Bool
+avivo_crtc_apply(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    Bool ret;
+    int i;
+
+    for (i = 0; i < config->num_crtc; i++) {
+        avivo_crtc = config->crtc[i]->driver_private;
+        if (!avivo_crtc->pending)
+            continue;
+        OUTREG(AVIVO_CRTC1_MASTER_UPDATE_LOCK + avivo_crtc->crtc_offset,
+               AVIVO_CRTC_MASTER_UPDATE_LOCK);
+        OUTREG(AVIVO_CRTC1_GRPH_UPDATE + avivo_crtc->crtc_offset,
+               AVIVO_CRTC_GRPH_UPDATE_LOCK);
+    }
+
+    ret = avivo_queue_flush(avivo);
+
+    for (i = 0; i < config->num_crtc; i++) {
+        avivo_crtc = config->crtc[i]->driver_private;
+        if (!avivo_crtc->pending)
+            continue;
+        OUTREG(AVIVO_CRTC1_GRPH_UPDATE + avivo_crtc->crtc_offset, 0);
+        OUTREG(AVIVO_CRTC1_MASTER_UPDATE_LOCK + avivo_crtc->crtc_offset, 0);
+    }
+
+    for (i = 0; i < config->num_crtc; i++) {
+        xf86CrtcPtr crtc = config->crtc[i];
+
+        avivo_crtc = crtc->driver_private;
+        if (!avivo_crtc->pending)
+            continue;
+        avivo_crtc->pending = FALSE;
+        /* the dividers are only known to be programmed now */
+        avivo_crtc->pll = avivo_crtc->pending_pll;
+        avivo_crtc->pll_valid = ret;
+        if (!ret)
+            xf86DrvMsg(screen_info->scrnIndex, X_WARNING,
+                       "crtc %d: mode may not have been applied\n",
+                       avivo_crtc->crtc_number);
+        crtc->funcs->dpms(crtc, DPMSModeOn);
+    }
+    if (screen_info->pScreen != NULL)
+        xf86_reload_cursors(screen_info->pScreen);
+    return ret;
+}
+
+/* Someone else may program the PLLs (VT switch), forget ours. */
+void
+avivo_crtc_pll_invalidate(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    int i;
+
+    for (i = 0; i < config->num_crtc; i++) {
+        avivo_crtc = config->crtc[i]->driver_private;
+        avivo_crtc->pll_valid = FALSE;
+    }
+}
+
+/*
+ * Hold back crtc commits so that several crtcs set one after the other
+ * (enter VT, mode switches, RandR requests) go out as a single image.
+ */
+void
+avivo_crtc_batch_begin(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+
+    avivo->crtc_batch = TRUE;
+}
+
+/*
+ * mode_fixup only saw one crtc at a time; check what the batch adds up
+ * to before any of it reaches the hardware.
+ */
+static Bool
+avivo_crtc_batch_validate(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    int i;
+
+    if (avivo->reg_queue.overflow) {
+        xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
+                   "crtc images don't fit the register queue\n");
+        return FALSE;
+    }
+    for (i = 0; i < config->num_crtc; i++) {
+        xf86CrtcPtr crtc = config->crtc[i];
+
+        avivo_crtc = crtc->driver_private;
+        if (!avivo_crtc->pending)
+            continue;
+        if (!avivo_crtc->pending_pll.post_div ||
+            avivo_crtc->pending_pll.ppm > AVIVO_PLL_MAX_PPM) {
+            xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
+                       "crtc(%d) no PLL dividers for %d kHz\n",
+                       avivo_crtc->crtc_number, crtc->mode.Clock);
+            return FALSE;
+        }
+        /* counts every other enabled crtc too */
+        if (!avivo_mode_bandwidth_ok(crtc, &crtc->mode)) {
+            xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
+                       "crtcs together exceed the memory bandwidth\n");
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Apply the batch, then turn on the outputs whose commit was held
+ * back.  If the crtcs can't run together nothing is written and the
+ * outputs stay off.
+ */
+Bool
+avivo_crtc_batch_end(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    Bool ret;
+    int i;
+
+    avivo->crtc_batch = FALSE;
+    if (!avivo_crtc_batch_validate(screen_info)) {
+        avivo_queue_cancel(avivo);
+        for (i = 0; i < config->num_crtc; i++) {
+            avivo_crtc = config->crtc[i]->driver_private;
+            avivo_crtc->pending = FALSE;
+        }
+        avivo_output_commit_pending(screen_info, FALSE);
+        return FALSE;
+    }
+    ret = avivo_crtc_apply(screen_info);
+    avivo_output_commit_pending(screen_info, TRUE);
+    return ret;
+}
+
+/* Is this crtc's PLL still at the dividers we last programmed? */
+static Bool
+avivo_crtc_pll_matches(xf86CrtcPtr crtc)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+    unsigned int post_div, div, mul, source;
+
+    source = INREG(AVIVO_CRTC_PLL_SOURCE);
+    if (avivo_crtc->crtc_number == 0) {
+        source >>= AVIVO_CRTC1_PLL_SOURCE_SHIFT;
+        post_div = INREG(AVIVO_PLL1_POST_DIV);
+        div = INREG(AVIVO_PLL1_DIVIDER);
+        mul = INREG(AVIVO_PLL1_POST_MUL) >> AVIVO_PLL_POST_MUL_SHIFT;
+    } else {
+        source >>= AVIVO_CRTC2_PLL_SOURCE_SHIFT;
+        post_div = INREG(AVIVO_PLL2_POST_DIV);
+        div = INREG(AVIVO_PLL2_DIVIDER);
+        mul = INREG(AVIVO_PLL2_POST_MUL) >> AVIVO_PLL_POST_MUL_SHIFT;
+    }
+    /* crtc n runs off PLL n+1, see avivo_crtc_set_pll() */
+    return (source & 1) == avivo_crtc->crtc_number &&
+        avivo_crtc->pll.post_div == post_div &&
+        avivo_crtc->pll.div == div && avivo_crtc->pll.mul == mul;
+}
+
+/*
+ * Does the chip still scan out what the last mode set programmed on
+ * this crtc?  Used to skip mode setting on enter VT.  pll_valid is
+ * gone by then, so the dividers are read back too, and so are the
+ * scanout size and the scaler.
+ */
+static Bool
+avivo_crtc_mode_matches(xf86CrtcPtr crtc)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+    unsigned long offset = avivo_crtc->crtc_offset;
+
+    /* never programmed */
+    if (avivo_crtc->h_total == 0 || avivo_crtc->pll.post_div == 0)
+        return FALSE;
+    return avivo_crtc_pll_matches(crtc) &&
+        (INREG(AVIVO_CRTC1_CNTL + offset) & AVIVO_CRTC_EN) &&
+        INREG(AVIVO_CRTC1_FB_LOCATION + offset) ==
+            avivo_crtc->fb_offset + avivo->fb_addr &&
+        INREG(AVIVO_CRTC1_FB_FORMAT + offset) == avivo_crtc->fb_format &&
+        INREG(AVIVO_CRTC1_PITCH + offset) == crtc->scrn->displayWidth &&
+        INREG(AVIVO_CRTC1_X_LENGTH + offset) == crtc->scrn->virtualX &&
+        INREG(AVIVO_CRTC1_Y_LENGTH + offset) == crtc->scrn->virtualY &&
+        INREG(AVIVO_CRTC1_EXPANSION_SOURCE + offset) ==
+            ((crtc->mode.HDisplay << 16) | crtc->mode.VDisplay) &&
+        INREG(AVIVO_CRTC1_EXPANSION_CNTL + offset) ==
+            AVIVO_CRTC_EXPANSION_EN &&
+        INREG(AVIVO_CRTC1_H_TOTAL + offset) == avivo_crtc->h_total &&
+        INREG(AVIVO_CRTC1_H_BLANK + offset) == avivo_crtc->h_blank &&
+        INREG(AVIVO_CRTC1_H_SYNC_WID + offset) == avivo_crtc->h_sync_wid &&
+        INREG(AVIVO_CRTC1_H_SYNC_POL + offset) == avivo_crtc->h_sync_pol &&
+        INREG(AVIVO_CRTC1_V_TOTAL + offset) == avivo_crtc->v_total &&
+        INREG(AVIVO_CRTC1_V_BLANK + offset) == avivo_crtc->v_blank &&
+        INREG(AVIVO_CRTC1_V_SYNC_WID + offset) == avivo_crtc->v_sync_wid &&
+        INREG(AVIVO_CRTC1_V_SYNC_POL + offset) == avivo_crtc->v_sync_pol;
+}
+
+/*
+ * TRUE if every enabled crtc is already set up the way we left it,
+ * watermarks included.  Outputs aren't checked, the caller commits
+ * them again.
+ */
+Bool
+avivo_crtc_modes_match(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    int i;
+
+    if ((INREG(AVIVO_DC_LB_MEMORY_SPLIT) & AVIVO_DC_LB_MEMORY_SPLIT_MASK) !=
+            avivo->wm.lb_split ||
+        INREG(AVIVO_CRTC1_PRIORITY_A_CNT) != avivo->wm.priority[0] ||
+        INREG(AVIVO_CRTC1_PRIORITY_B_CNT) != avivo->wm.priority_b[0] ||
+        INREG(AVIVO_CRTC2_PRIORITY_A_CNT) != avivo->wm.priority[1] ||
+        INREG(AVIVO_CRTC2_PRIORITY_B_CNT) != avivo->wm.priority_b[1])
+        return FALSE;
+
+    for (i = 0; i < config->num_crtc; i++) {
+        xf86CrtcPtr crtc = config->crtc[i];
+
+        if (crtc->enabled && !avivo_crtc_mode_matches(crtc))
+            return FALSE;
+    }
+    return TRUE;
 }
 
 static void
 avivo_crtc_commit(xf86CrtcPtr crtc)
 {
-    crtc->funcs->dpms (crtc, DPMSModeOn);
-    if (crtc->scrn->pScreen != NULL)
-        xf86_reload_cursors(crtc->scrn->pScreen);
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+
+    if (!avivo->crtc_batch)
+        avivo_crtc_apply(crtc->scrn);
 }
 
 static void *
@@ -400,7 +830,8 @@ avivo_crtc_set_cursor_position(xf86CrtcPtr crtc, int x, int y)
     if (y < 0)
         y = 0;
 
-    OUTREG(AVIVO_CURSOR1_POSITION + avivo_crtc->crtc_offset, (x << 16) | y);
+    avivo_reg_write(avivo, AVIVO_CURSOR1_POSITION + avivo_crtc->crtc_offset,
+                    (x << 16) | y);
     avivo_crtc->cursor_x = x;
     avivo_crtc->cursor_y = y;
 }
@@ -411,9 +842,13 @@ avivo_crtc_show_cursor(xf86CrtcPtr crtc)
     struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
     struct avivo_info *avivo = avivo_get_info(crtc->scrn);
 
-    OUTREG(AVIVO_CURSOR1_CNTL + avivo_crtc->crtc_offset,
-           INREG(AVIVO_CURSOR1_CNTL + avivo_crtc->crtc_offset)
-           | AVIVO_CURSOR_EN);
+    /* the image is always padded to 64x64 ARGB, see load_argb */
+    OUTREG(AVIVO_CURSOR1_LOCATION + avivo_crtc->crtc_offset,
+           avivo->fb_addr + avivo_crtc->cursor_offset);
+    OUTREG(AVIVO_CURSOR1_SIZE + avivo_crtc->crtc_offset, (63 << 16) | 63);
+    avivo_reg_write(avivo, AVIVO_CURSOR1_CNTL + avivo_crtc->crtc_offset,
+                    AVIVO_CURSOR_EN |
+                    (AVIVO_CURSOR_FORMAT_ARGB << AVIVO_CURSOR_FORMAT_SHIFT));
 }
 
 static void
@@ -422,19 +857,66 @@ avivo_crtc_hide_cursor(xf86CrtcPtr crtc)
     struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
     struct avivo_info *avivo = avivo_get_info(crtc->scrn);
 
-    OUTREG(AVIVO_CURSOR1_CNTL+ avivo_crtc->crtc_offset,
-           INREG(AVIVO_CURSOR1_CNTL + avivo_crtc->crtc_offset)
-           & ~(AVIVO_CURSOR_EN));
+    avivo_reg_rmw(avivo, AVIVO_CURSOR1_CNTL + avivo_crtc->crtc_offset,
+                  AVIVO_CURSOR_EN, 0);
 }
 
 static void
 avivo_crtc_cursor_load_argb(xf86CrtcPtr crtc, CARD32 *image)
 {
     struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
-    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
-    CARD32 *dst = (CARD32 *)(avivo->fb_base + avivo_crtc->cursor_offset);
 
-    memcpy(dst, image, 64 * 64 * 4);
+    /* the heap may have put it past the BAR */
+    avivo_vram_write(crtc->scrn, avivo_crtc->cursor_offset, image,
+                     AVIVO_CURSOR_BYTES);
+}
+
+/*
+ * Hardware cursors.  Each crtc gets its image from the VRAM heap, never
+ * from offset 0, which is the front buffer.
+ */
+Bool
+avivo_crtc_cursor_init(ScreenPtr screen)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    xf86CrtcConfigPtr xf86_config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    int i;
+
+    for (i = 0; i < xf86_config->num_crtc; i++) {
+        avivo_crtc = xf86_config->crtc[i]->driver_private;
+        avivo_crtc->cursor_offset = avivo_vram_alloc(screen_info,
+                                                     AVIVO_CURSOR_BYTES,
+                                                     AVIVO_VRAM_ALIGN);
+        if (!avivo_crtc->cursor_offset) {
+            avivo_crtc_cursor_fini(screen);
+            return FALSE;
+        }
+    }
+    if (!xf86_cursors_init(screen, 64, 64,
+                           HARDWARE_CURSOR_TRUECOLOR_AT_8BPP |
+                           HARDWARE_CURSOR_ARGB |
+                           HARDWARE_CURSOR_UPDATE_UNHIDDEN)) {
+        avivo_crtc_cursor_fini(screen);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void
+avivo_crtc_cursor_fini(ScreenPtr screen)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    xf86CrtcConfigPtr xf86_config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    int i;
+
+    for (i = 0; i < xf86_config->num_crtc; i++) {
+        avivo_crtc = xf86_config->crtc[i]->driver_private;
+        if (avivo_crtc->cursor_offset)
+            avivo_vram_free(screen_info, avivo_crtc->cursor_offset);
+        avivo_crtc->cursor_offset = 0;
+    }
 }
 
 static void
@@ -483,7 +965,7 @@ avivo_crtc_init(ScrnInfoPtr screen_info, int crtc_number)
     avivo_crtc->cursor_offset = 0;
     avivo_crtc->crtc_offset = 0;
     if (avivo_crtc->crtc_number == 1)
-        avivo_crtc->crtc_offset = AVIVO_CRTC2_H_TOTAL - AVIVO_CRTC1_H_TOTAL;
+        avivo_crtc->crtc_offset = AVIVO_CRTC2_OFFSET;
 
     /* allocate & initialize xf86Crtc */
     crtc = xf86CrtcCreate (screen_info, &avivo_crtc_funcs);
@@ -501,14 +983,17 @@ avivo_crtc_init(ScrnInfoPtr screen_info, int crtc_number)
 Bool
 avivo_crtc_create(ScrnInfoPtr screen_info)
 {
+    struct avivo_info *avivo = avivo_get_info(screen_info);
     xf86CrtcConfigPtr xf86_crtc_config;
+    int max_width, max_height;
 
     /* allocate crtc config and register crtc config function ie the resize
      * function which is a dummy function as i believe it should get call
      * with value higher than those set with xf86CrtcSetSizeRange
      */
     xf86CrtcConfigInit(screen_info, &avivo_xf86crtc_config_funcs);
-    xf86CrtcSetSizeRange(screen_info, 320, 200, 2048, 2048);
+    avivo_get_max_size(avivo, &max_width, &max_height);
+    xf86CrtcSetSizeRange(screen_info, 320, 200, max_width, max_height);
 
     xf86_crtc_config = XF86_CRTC_CONFIG_PTR(screen_info);
 
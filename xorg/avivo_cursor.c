@@ -38,7 +38,7 @@ avivo_cursor_show(ScrnInfoPtr screen_info)
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
 
-    OUTREG(AVIVO_CURSOR1_CNTL, INREG(AVIVO_CURSOR1_CNTL) | AVIVO_CURSOR_EN);
+    avivo_reg_rmw(avivo, AVIVO_CURSOR1_CNTL, 0, AVIVO_CURSOR_EN);
 }
 
 static void
@@ -46,7 +46,7 @@ avivo_cursor_hide(ScrnInfoPtr screen_info)
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
 
-    OUTREG(AVIVO_CURSOR1_CNTL, INREG(AVIVO_CURSOR1_CNTL) & ~(AVIVO_CURSOR_EN));
+    avivo_reg_rmw(avivo, AVIVO_CURSOR1_CNTL, AVIVO_CURSOR_EN, 0);
 }
 
 static void
@@ -59,7 +59,7 @@ avivo_cursor_set_position(ScrnInfoPtr screen_info, int x, int y)
     if (y < 0)
         y = 0;
 
-    OUTREG(AVIVO_CURSOR1_POSITION, (x << 16) | y);
+    avivo_reg_write(avivo, AVIVO_CURSOR1_POSITION, (x << 16) | y);
 
     avivo->cursor_x = x;
     avivo->cursor_y = y;
@@ -69,16 +69,16 @@ void
 avivo_setup_cursor(struct avivo_info *avivo, int id, int enable)
 {
     if (id == 1) {
-        OUTREG(AVIVO_CURSOR1_CNTL, 0);
+        avivo_reg_write(avivo, AVIVO_CURSOR1_CNTL, 0);
 
         if (enable) {
             OUTREG(AVIVO_CURSOR1_LOCATION, avivo->fb_addr +
                                            avivo->cursor_offset);
             OUTREG(AVIVO_CURSOR1_SIZE, (avivo->cursor_width << 16) |
                                        avivo->cursor_height);
-            OUTREG(AVIVO_CURSOR1_CNTL, AVIVO_CURSOR_EN |
-                                       (avivo->cursor_format <<
-                                        AVIVO_CURSOR_FORMAT_SHIFT));
+            avivo_reg_write(avivo, AVIVO_CURSOR1_CNTL,
+                            AVIVO_CURSOR_EN |
+                            (avivo->cursor_format << AVIVO_CURSOR_FORMAT_SHIFT));
         }
     }
 }
@@ -0,0 +1,229 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo page flipping: point a crtc at another buffer in VRAM at its
+ * next vblank, no copy.  Nothing in the driver flips, so this is
+ * test-only and built only with --enable-page-flip.  With the shadow
+ * frame buffer on, X only ever reaches the screen through the flush
+ * to fbOffset, so flips elsewhere are refused there: the crtc would
+ * stop showing what X draws.  avivotool flipcheck checks on a card
+ * that flips latch inside vblank.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef AVIVO_PAGE_FLIP
+#include <unistd.h>
+
+#include "avivo.h"
+#include "radeon_reg.h"
+
+/* no crtc runs slower than 10 Hz, a flip is done within 100 ms */
+#define AVIVO_FLIP_TIMEOUT  100000
+#define AVIVO_FLIP_SLEEP    1000
+
+/*
+ * Program the flip at the head of the queue.  With the graphics update
+ * lock held the crtc keeps scanning the old buffer; once released it
+ * latches the new location at vblank and clears the pending bit.
+ */
+static void
+avivo_crtc_flip_arm(xf86CrtcPtr crtc)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+    struct avivo_flip_queue *queue = &avivo_crtc->flip;
+    unsigned long offset = avivo_crtc->crtc_offset;
+    unsigned long fb_location;
+
+    fb_location = avivo->fb_addr + queue->entry[queue->head].fb_offset;
+    OUTREG(AVIVO_CRTC1_GRPH_UPDATE + offset, AVIVO_CRTC_GRPH_UPDATE_LOCK);
+    OUTREG(AVIVO_CRTC1_FB_LOCATION + offset, fb_location);
+    OUTREG(AVIVO_CRTC1_FB_END + offset, fb_location + avivo_crtc->fb_length);
+    OUTREG(AVIVO_CRTC1_GRPH_UPDATE + offset, 0);
+    queue->armed = TRUE;
+}
+
+static void
+avivo_crtc_flip_pop(xf86CrtcPtr crtc, Bool shown)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_flip_queue *queue = &avivo_crtc->flip;
+    struct avivo_flip *flip = &queue->entry[queue->head];
+    unsigned long elapsed;
+
+    if (shown) {
+        avivo_crtc->fb_offset = flip->fb_offset;
+        elapsed = avivo_get_usec() - flip->queued_usec;
+        queue->completed++;
+        queue->total_usec += elapsed;
+        if (elapsed > queue->max_usec)
+            queue->max_usec = elapsed;
+    } else
+        queue->cancelled++;
+    queue->head = (queue->head + 1) % AVIVO_FLIP_QUEUE_SIZE;
+    queue->count--;
+    queue->armed = FALSE;
+    if (flip->done)
+        flip->done(crtc, flip->data, shown);
+}
+
+/*
+ * Queue a flip of the crtc to fb_offset (from the start of VRAM).  done
+ * is called once the crtc scans out of the new buffer, or with shown
+ * FALSE if the flip gets cancelled.  Returns FALSE, without calling
+ * done, if the buffer doesn't fit, the queue is full, or the shadow
+ * frame buffer is flushed somewhere else.
+ */
+Bool
+avivo_crtc_flip(xf86CrtcPtr crtc, unsigned long fb_offset,
+                avivo_flip_done_proc done, void *data)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+    struct avivo_flip_queue *queue = &avivo_crtc->flip;
+    struct avivo_flip *flip;
+
+    avivo_crtc_flip_poll(crtc);
+    if (!crtc->enabled || fb_offset % AVIVO_CRTC_PITCH_ALIGN ||
+        fb_offset + avivo_crtc->fb_length > avivo->vram_size ||
+        queue->count == AVIVO_FLIP_QUEUE_SIZE ||
+        (avivo->fb_shadow != NULL && fb_offset != crtc->scrn->fbOffset)) {
+        queue->rejected++;
+        return FALSE;
+    }
+
+    flip = &queue->entry[(queue->head + queue->count) %
+                         AVIVO_FLIP_QUEUE_SIZE];
+    flip->fb_offset = fb_offset;
+    flip->done = done;
+    flip->data = data;
+    flip->queued_usec = avivo_get_usec();
+    queue->count++;
+    queue->queued++;
+    if (!queue->armed)
+        avivo_crtc_flip_arm(crtc);
+    return TRUE;
+}
+
+/*
+ * Retire the flip that was latched, if the crtc went through vblank
+ * since, and program the next one.  At most one flip completes per
+ * call so that every buffer is on screen for a frame at least.
+ * Returns the number of flips completed.
+ */
+int
+avivo_crtc_flip_poll(xf86CrtcPtr crtc)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+    struct avivo_flip_queue *queue = &avivo_crtc->flip;
+
+    if (!queue->armed)
+        return 0;
+    if (avivo_reg_read(avivo, AVIVO_CRTC1_GRPH_UPDATE +
+                              avivo_crtc->crtc_offset) &
+        AVIVO_CRTC_GRPH_SURFACE_UPDATE_PENDING)
+        return 0;
+    avivo_crtc_flip_pop(crtc, TRUE);
+    if (queue->count)
+        avivo_crtc_flip_arm(crtc);
+    return 1;
+}
+
+/* wait for every queued flip to reach the screen */
+Bool
+avivo_crtc_flip_wait(xf86CrtcPtr crtc)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_flip_queue *queue = &avivo_crtc->flip;
+    unsigned long start = avivo_get_usec();
+
+    while (queue->count) {
+        if (avivo_crtc_flip_poll(crtc))
+            start = avivo_get_usec();
+        else if (avivo_get_usec() - start > AVIVO_FLIP_TIMEOUT)
+            return FALSE;
+        else
+            usleep(AVIVO_FLIP_SLEEP);
+    }
+    return TRUE;
+}
+
+/*
+ * Drop every flip not on screen yet, on mode set or VT switch.  One
+ * already latched may still land; the crtc gets reprogrammed anyway.
+ */
+void
+avivo_crtc_flip_cancel(xf86CrtcPtr crtc)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+
+    while (avivo_crtc->flip.count)
+        avivo_crtc_flip_pop(crtc, FALSE);
+}
+
+void
+avivo_flip_cancel_all(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    int i;
+
+    for (i = 0; i < config->num_crtc; i++)
+        avivo_crtc_flip_cancel(config->crtc[i]);
+}
+
+void
+avivo_flip_poll_all(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    int i;
+
+    for (i = 0; i < config->num_crtc; i++)
+        avivo_crtc_flip_poll(config->crtc[i]);
+}
+
+void
+avivo_flip_dump_stats(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    struct avivo_flip_queue *queue;
+    int i;
+
+    for (i = 0; i < config->num_crtc; i++) {
+        avivo_crtc = config->crtc[i]->driver_private;
+        queue = &avivo_crtc->flip;
+        if (!queue->queued && !queue->rejected)
+            continue;
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "crtc(%d) flips: %lu queued, %lu completed, "
+                   "%lu cancelled, %lu rejected, %lu us avg, %lu us max\n",
+                   avivo_crtc->crtc_number, queue->queued, queue->completed,
+                   queue->cancelled, queue->rejected,
+                   queue->completed ? queue->total_usec / queue->completed
+                                    : 0,
+                   queue->max_usec);
+    }
+}
+#endif /* AVIVO_PAGE_FLIP */
@@ -22,28 +22,44 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include <string.h>
+
 #include "avivo.h"
 #include "radeon_reg.h"
 
-void
+Bool
 avivo_setup_gpu_memory_map(ScrnInfoPtr screen_info)
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
     unsigned long mc_memory_map;
     unsigned long mc_memory_map_end;
+    unsigned long vga_memory_base;
 
     /* init gpu memory mapping */
     mc_memory_map = (avivo->fb_addr >> 16) & AVIVO_MC_MEMORY_MAP_BASE_MASK;
-    mc_memory_map_end = ((avivo->fb_addr + avivo->fb_size) >> 16) - 1;
+    /* in 64 kB units, so boards with 1 GB or more don't wrap the sum */
+    mc_memory_map_end = (avivo->fb_addr >> 16) + (avivo->vram_size >> 16) - 1;
+    if (mc_memory_map_end > 0xffff)
+        mc_memory_map_end = 0xffff;
     mc_memory_map |= (mc_memory_map_end << AVIVO_MC_MEMORY_MAP_END_SHIFT)
         & AVIVO_MC_MEMORY_MAP_END_MASK;
+    vga_memory_base = (avivo->fb_addr >> 16) & AVIVO_MC_MEMORY_MAP_BASE_MASK;
+    /* nothing to do if the mapping survived a VT switch */
+    if (avivo_get_mc(screen_info, AVIVO_MC_MEMORY_MAP) == mc_memory_map &&
+        INREG(AVIVO_VGA_MEMORY_BASE) == vga_memory_base &&
+        INREG(AVIVO_VGA_FB_START) == avivo->fb_addr)
+        return TRUE;
     avivo_set_mc(screen_info, AVIVO_MC_MEMORY_MAP, mc_memory_map);
-    OUTREG(AVIVO_VGA_MEMORY_BASE,
-           (avivo->fb_addr >> 16) & AVIVO_MC_MEMORY_MAP_BASE_MASK);
+    OUTREG(AVIVO_VGA_MEMORY_BASE, vga_memory_base);
     OUTREG(AVIVO_VGA_FB_START, avivo->fb_addr);
-    avivo_wait_idle(avivo);
+    if (!avivo_wait_idle(avivo)) {
+        xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
+                   "GPU memory mapping didn't settle\n");
+        return FALSE;
+    }
     xf86DrvMsg(screen_info->scrnIndex, X_INFO,
                "setup GPU memory mapping\n");
+    return TRUE;
 }
 
 FBLinearPtr
@@ -72,3 +88,124 @@ avivo_xf86AllocateOffscreenLinear(ScreenPtr screen, int length,
     return xf86AllocateOffscreenLinear(screen, length, granularity, moveCB,
                                        removeCB, priv_data);
 }
+
+/*
+ * Offscreen memory.  The XFree86 manager gets the lines the BAR maps
+ * below the front buffer's pitch, as far as its 16 bit boxes go, so
+ * rotation shadows stay CPU visible.  Whatever VRAM is left, and at
+ * least AVIVO_VRAM_MIN_HEAP of it, goes to the driver heap, whose
+ * blocks are handed out as plain offsets (cursor images for now).
+ */
+Bool
+avivo_vram_screen_init(ScreenPtr screen)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_vram_heap *heap = &avivo->vram;
+    unsigned long pitch, lines;
+    BoxRec box;
+
+    pitch = screen_info->displayWidth * avivo->bpp;
+    lines = avivo->fb_size / pitch;
+    if (avivo->vram_size - lines * pitch < AVIVO_VRAM_MIN_HEAP)
+        lines = (avivo->vram_size - AVIVO_VRAM_MIN_HEAP) / pitch;
+    if (lines > MAXSHORT)
+        lines = MAXSHORT;
+    avivo_vram_heap_init(heap, lines * pitch, avivo->vram_size);
+    if (heap->start < heap->end)
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "%lu kB of VRAM for the driver heap at 0x%08lx\n",
+                   (heap->end - heap->start) / 1024, heap->start);
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = screen_info->displayWidth;
+    box.y2 = lines;
+    if (lines <= screen_info->virtualY)
+        return FALSE;
+    return xf86InitFBManager(screen, &box);
+}
+
+unsigned long
+avivo_vram_alloc(ScrnInfoPtr screen_info, unsigned long size,
+                 unsigned long align)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+
+    return avivo_vram_heap_alloc(&avivo->vram, size, align);
+}
+
+void
+avivo_vram_free(ScrnInfoPtr screen_info, unsigned long offset)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+
+    if (!avivo_vram_heap_free(&avivo->vram, offset))
+        xf86DrvMsg(screen_info->scrnIndex, X_WARNING,
+                   "freeing unknown VRAM block 0x%08lx\n", offset);
+}
+
+/*
+ * Copy to and from VRAM.  Inside the BAR this is a plain copy through
+ * the mapping; past it each dword goes through MM_INDEX/MM_DATA, with
+ * RADEON_MM_APER set so the index addresses the frame buffer instead
+ * of the register file.  Offset and size must be dword aligned.
+ */
+void
+avivo_vram_write(ScrnInfoPtr screen_info, unsigned long offset,
+                 const void *data, unsigned long size)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    const CARD32 *src;
+    unsigned long mapped = 0;
+
+    if (offset < avivo->fb_size) {
+        mapped = avivo->fb_size - offset;
+        if (mapped > size)
+            mapped = size;
+        memcpy((CARD8 *)avivo->fb_base + offset, data, mapped);
+    }
+    src = (const CARD32 *)((const CARD8 *)data + mapped);
+    for (offset += mapped, size -= mapped; size >= 4; offset += 4, size -= 4) {
+        OUTREG(RADEON_MM_INDEX, offset | RADEON_MM_APER);
+        OUTREG(RADEON_MM_DATA, *src++);
+        avivo->vram.window_bytes += 4;
+    }
+}
+
+void
+avivo_vram_read(ScrnInfoPtr screen_info, unsigned long offset,
+                void *data, unsigned long size)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    CARD32 *dst;
+    unsigned long mapped = 0;
+
+    if (offset < avivo->fb_size) {
+        mapped = avivo->fb_size - offset;
+        if (mapped > size)
+            mapped = size;
+        memcpy(data, (CARD8 *)avivo->fb_base + offset, mapped);
+    }
+    dst = (CARD32 *)((CARD8 *)data + mapped);
+    for (offset += mapped, size -= mapped; size >= 4; offset += 4, size -= 4) {
+        OUTREG(RADEON_MM_INDEX, offset | RADEON_MM_APER);
+        *dst++ = INREG(RADEON_MM_DATA);
+        avivo->vram.window_bytes += 4;
+    }
+}
+
+void
+avivo_vram_dump_stats(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_vram_heap *heap = &avivo->vram;
+
+    if (!heap->allocs && !heap->failures)
+        return;
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "VRAM heap: %lu allocations, %lu failed, %d in use, "
+               "%lu bytes through the window\n",
+               heap->allocs, heap->failures, heap->count,
+               heap->window_bytes);
+}
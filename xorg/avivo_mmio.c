@@ -0,0 +1,501 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo mmio backends.
+ *
+ * INREG/OUTREG go straight to the chip unless another backend was
+ * asked for with Option "MMIOBackend":
+ *  - "hw": the real chip (default),
+ *  - "sim": an in-memory register file, the chip isn't touched once
+ *    the backend is set up; enabled crtcs scan out on a model of their
+ *    programmed timings,
+ *  - "record": the real chip, with every access logged.
+ * The backend only takes over at the end of PreInit: probing still
+ * needs the PCI device and reads the memory size, the BIOS and the
+ * mapped registers of a real card.  "sim" keeps mode setting off that
+ * card, it doesn't replace it.
+ * Both "sim" and "record" keep a timestamped trace of the last
+ * AVIVO_MMIO_TRACE_SIZE accesses which is dumped to the log (verbosity
+ * 5) when the screen is closed, so mode set, state save/restore, cursor
+ * and I2C sequences can be compared between runs.
+ *
+ * Independently of the backend, Option "MMIOStats" counts reads and
+ * writes per register and times every read.  The summary goes to the
+ * log when the screen is closed and can be fetched at any time through
+ * the AVIVO_MMIO_STATS output property (see avivo_output.c).
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+#include <time.h>
+
+#include "avivo.h"
+#include "radeon_reg.h"
+
+/* MC registers live behind AVIVO_MC_INDEX/AVIVO_MC_DATA */
+#define AVIVO_MMIO_SIM_MC_SIZE 0x100
+
+/* since the backend was set up; monotonic, the sim crtcs run on it */
+static unsigned long
+avivo_mmio_usec(struct avivo_info *avivo)
+{
+    return avivo_get_usec() - avivo->mmio.start_usec;
+}
+
+static unsigned long
+avivo_mmio_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int
+avivo_mmio_log2(unsigned long ns)
+{
+    int bucket = 0;
+
+    while (ns > 1 && bucket < AVIVO_MMIO_HIST_SIZE - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void
+avivo_mmio_count(struct avivo_info *avivo, unsigned int reg,
+                 Bool write, unsigned long ns)
+{
+    struct avivo_mmio_stats *stats = avivo->mmio.stats;
+    unsigned int i = reg >> 2;
+
+    if (write) {
+        stats->total_writes++;
+        if (i < AVIVO_MMIO_STATS_REGS)
+            stats->writes[i]++;
+        return;
+    }
+    stats->total_reads++;
+    stats->total_read_ns += ns;
+    stats->read_hist[avivo_mmio_log2(ns)]++;
+    if (i < AVIVO_MMIO_STATS_REGS) {
+        stats->reads[i]++;
+        stats->read_ns[i] += ns;
+    }
+}
+
+static void
+avivo_mmio_trace(struct avivo_info *avivo, unsigned int reg,
+                 unsigned int value, Bool write)
+{
+    struct avivo_mmio *mmio = &avivo->mmio;
+    struct avivo_mmio_trace *trace;
+
+    trace = &mmio->trace[mmio->trace_count % AVIVO_MMIO_TRACE_SIZE];
+    trace->usec = avivo_mmio_usec(avivo);
+    trace->reg = reg;
+    trace->value = value;
+    trace->write = write;
+    mmio->trace_count++;
+}
+
+#define SIM_REG(reg) (avivo->mmio.sim_regs[(reg) >> 2])
+#define SIM_CRTC2    AVIVO_CRTC2_OFFSET
+
+/*
+ * "sim" crtc timing model: a crtc that is enabled scans out at the
+ * clock its PLL is programmed for, with the totals programmed in its
+ * timing registers, from the moment the backend was set up.  Like the
+ * chip, it counts lines from the start of vsync, with the active area
+ * where V_BLANK puts it.  Gives the frame count and position
+ * avivo_vblank.c reads; returns FALSE if the crtc isn't running.
+ */
+static Bool
+avivo_mmio_sim_scanout(struct avivo_info *avivo, int crtc,
+                       CARD32 *frame, int *line, int *pixel)
+{
+    unsigned long offset = crtc ? SIM_CRTC2 : 0;
+    unsigned long pixels;
+    int htotal, vtotal, post_div, div, mul, clock;
+
+    if (!(SIM_REG(AVIVO_CRTC1_CNTL + offset) & AVIVO_CRTC_EN))
+        return FALSE;
+    if (crtc && (SIM_REG(AVIVO_CRTC_PLL_SOURCE) >>
+                 AVIVO_CRTC2_PLL_SOURCE_SHIFT) & 1) {
+        post_div = SIM_REG(AVIVO_PLL2_POST_DIV);
+        div = SIM_REG(AVIVO_PLL2_DIVIDER);
+        mul = SIM_REG(AVIVO_PLL2_POST_MUL) >> AVIVO_PLL_POST_MUL_SHIFT;
+    } else {
+        post_div = SIM_REG(AVIVO_PLL1_POST_DIV);
+        div = SIM_REG(AVIVO_PLL1_DIVIDER);
+        mul = SIM_REG(AVIVO_PLL1_POST_MUL) >> AVIVO_PLL_POST_MUL_SHIFT;
+    }
+    htotal = SIM_REG(AVIVO_CRTC1_H_TOTAL + offset) + 1;
+    vtotal = SIM_REG(AVIVO_CRTC1_V_TOTAL + offset) + 1;
+    if (!post_div || !div || !mul || htotal < 2 || vtotal < 2)
+        return FALSE;
+    clock = AVIVO_PLL_REF * mul / (post_div * div);
+
+    /* us * kHz / 1000 = pixels */
+    pixels = avivo_mmio_usec(avivo) * (unsigned long)clock / 1000;
+    *frame = pixels / ((unsigned long)htotal * vtotal);
+    pixels %= (unsigned long)htotal * vtotal;
+    *line = pixels / htotal;
+    *pixel = pixels % htotal;
+    /* the counter ticks as vblank starts */
+    if (*line >= (SIM_REG(AVIVO_CRTC1_V_BLANK + offset) & 0xffff))
+        (*frame)++;
+    return TRUE;
+}
+
+static unsigned int
+avivo_mmio_sim_crtc_read(struct avivo_info *avivo, unsigned int reg,
+                         int crtc)
+{
+    unsigned long offset = crtc ? SIM_CRTC2 : 0;
+    int line = 0, pixel = 0, start, end;
+    CARD32 frame = 0, v_blank;
+    Bool running;
+
+    running = avivo_mmio_sim_scanout(avivo, crtc, &frame, &line, &pixel);
+    switch (reg - offset) {
+    case AVIVO_CRTC1_STATUS:
+        /* see avivo_crtc_mode_set() for the V_BLANK layout */
+        v_blank = SIM_REG(AVIVO_CRTC1_V_BLANK + offset);
+        start = v_blank & 0xffff;
+        end = (v_blank >> 16) & 0xffff;
+        return running && (line >= start || line < end) ?
+               AVIVO_CRTC_V_BLANK : 0;
+    case AVIVO_CRTC1_STATUS_POSITION:
+        return (pixel << AVIVO_CRTC_H_POSITION_SHIFT) | line;
+    case AVIVO_CRTC1_STATUS_FRAME_COUNT:
+        return frame;
+    case AVIVO_CRTC1_GRPH_UPDATE:
+        /* a released update is latched at the next vblank */
+        if (avivo->mmio.sim_latch_pending[crtc] &&
+            (!running || frame != avivo->mmio.sim_latch_frame[crtc]))
+            avivo->mmio.sim_latch_pending[crtc] = FALSE;
+        return SIM_REG(reg) |
+               (avivo->mmio.sim_latch_pending[crtc] ?
+                AVIVO_CRTC_GRPH_SURFACE_UPDATE_PENDING : 0);
+    }
+    return SIM_REG(reg);
+}
+
+static unsigned int
+avivo_mmio_sim_read(struct avivo_info *avivo, unsigned int reg)
+{
+    struct avivo_mmio *mmio = &avivo->mmio;
+
+    if (reg == AVIVO_MC_DATA) {
+        if ((mmio->sim_mc_index & 0xffff) < AVIVO_MMIO_SIM_MC_SIZE)
+            return mmio->sim_mc[mmio->sim_mc_index & 0xffff];
+        return 0;
+    }
+    if (reg >= AVIVO_MMIO_SIM_SIZE)
+        return 0;
+    switch (reg) {
+    case AVIVO_CRTC1_STATUS:
+    case AVIVO_CRTC1_STATUS_POSITION:
+    case AVIVO_CRTC1_STATUS_FRAME_COUNT:
+    case AVIVO_CRTC1_GRPH_UPDATE:
+        return avivo_mmio_sim_crtc_read(avivo, reg, 0);
+    case AVIVO_CRTC1_STATUS + SIM_CRTC2:
+    case AVIVO_CRTC1_STATUS_POSITION + SIM_CRTC2:
+    case AVIVO_CRTC1_STATUS_FRAME_COUNT + SIM_CRTC2:
+    case AVIVO_CRTC1_GRPH_UPDATE + SIM_CRTC2:
+        return avivo_mmio_sim_crtc_read(avivo, reg, 1);
+    }
+    return mmio->sim_regs[reg >> 2];
+}
+
+static void
+avivo_mmio_sim_write(struct avivo_info *avivo, unsigned int reg,
+                     unsigned int value)
+{
+    struct avivo_mmio *mmio = &avivo->mmio;
+
+    if (reg == AVIVO_MC_INDEX)
+        mmio->sim_mc_index = value;
+    if (reg == AVIVO_MC_DATA) {
+        if ((mmio->sim_mc_index & 0xffff) < AVIVO_MMIO_SIM_MC_SIZE)
+            mmio->sim_mc[mmio->sim_mc_index & 0xffff] = value;
+        return;
+    }
+    if (reg >= AVIVO_MMIO_SIM_SIZE)
+        return;
+    /* releasing the update lock arms a latch at the next vblank */
+    if (reg == AVIVO_CRTC1_GRPH_UPDATE ||
+        reg == AVIVO_CRTC1_GRPH_UPDATE + SIM_CRTC2) {
+        int crtc = reg != AVIVO_CRTC1_GRPH_UPDATE;
+        int line, pixel;
+        CARD32 frame;
+
+        if ((mmio->sim_regs[reg >> 2] & AVIVO_CRTC_GRPH_UPDATE_LOCK) &&
+            !(value & AVIVO_CRTC_GRPH_UPDATE_LOCK) &&
+            avivo_mmio_sim_scanout(avivo, crtc, &frame, &line, &pixel)) {
+            mmio->sim_latch_frame[crtc] = frame;
+            mmio->sim_latch_pending[crtc] = TRUE;
+        }
+        value &= ~AVIVO_CRTC_GRPH_SURFACE_UPDATE_PENDING;
+    }
+    mmio->sim_regs[reg >> 2] = value;
+}
+
+/*
+ * Put enough in the register file for the driver to run: the chip is
+ * idle, memory size matches what we mapped and the LVDS power sequencer
+ * reports off so DPMS doesn't spin forever.
+ */
+static void
+avivo_mmio_sim_seed(struct avivo_info *avivo)
+{
+    avivo_mmio_sim_write(avivo, RADEON_CONFIG_MEMSIZE, avivo->vram_size);
+    avivo_mmio_sim_write(avivo, 0x6494, 0x3fffffff);
+    avivo_mmio_sim_write(avivo, AVIVO_LVTMA_PWRSEQ_STATE,
+                         0x8 << AVIVO_LVTMA_PWRSEQ_STATE_STATUS_SHIFT);
+}
+
+unsigned int
+avivo_mmio_read(struct avivo_info *avivo, unsigned int reg)
+{
+    unsigned long start = 0;
+    unsigned int value;
+
+    if (avivo->mmio.stats)
+        start = avivo_mmio_ns();
+    if (avivo->mmio.backend == AVIVO_MMIO_SIM)
+        value = avivo_mmio_sim_read(avivo, reg);
+    else
+        value = MMIO_IN32(avivo->ctrl_base, reg);
+    if (avivo->mmio.stats)
+        avivo_mmio_count(avivo, reg, FALSE, avivo_mmio_ns() - start);
+    if (avivo->mmio.trace)
+        avivo_mmio_trace(avivo, reg, value, FALSE);
+    return value;
+}
+
+void
+avivo_mmio_write(struct avivo_info *avivo,
+                 unsigned int reg,
+                 unsigned int value)
+{
+    if (avivo->mmio.backend == AVIVO_MMIO_SIM)
+        avivo_mmio_sim_write(avivo, reg, value);
+    else
+        MMIO_OUT32(avivo->ctrl_base, reg, value);
+    if (avivo->mmio.stats)
+        avivo_mmio_count(avivo, reg, TRUE, 0);
+    if (avivo->mmio.trace)
+        avivo_mmio_trace(avivo, reg, value, TRUE);
+}
+
+Bool
+avivo_mmio_init(ScrnInfoPtr screen_info, const char *backend, Bool stats)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_mmio *mmio = &avivo->mmio;
+
+    mmio->hooked = FALSE;
+    mmio->backend = AVIVO_MMIO_HW;
+    if (stats) {
+        mmio->stats = xcalloc(1, sizeof(struct avivo_mmio_stats));
+        if (mmio->stats == NULL) {
+            xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
+                       "Couldn't allocate MMIO statistics\n");
+            return FALSE;
+        }
+        mmio->hooked = TRUE;
+        xf86DrvMsg(screen_info->scrnIndex, X_CONFIG,
+                   "counting MMIO accesses\n");
+    }
+    if (backend == NULL || !strcmp(backend, "hw"))
+        return TRUE;
+
+    if (!strcmp(backend, "sim")) {
+        mmio->sim_regs = xcalloc(1, AVIVO_MMIO_SIM_SIZE);
+        mmio->sim_mc = xcalloc(AVIVO_MMIO_SIM_MC_SIZE, sizeof(CARD32));
+        if (mmio->sim_regs == NULL || mmio->sim_mc == NULL)
+            goto fail;
+    } else if (strcmp(backend, "record")) {
+        xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
+                   "unknown MMIO backend \"%s\"\n", backend);
+        avivo_mmio_fini(screen_info);
+        return FALSE;
+    }
+
+    mmio->trace = xcalloc(AVIVO_MMIO_TRACE_SIZE,
+                          sizeof(struct avivo_mmio_trace));
+    if (mmio->trace == NULL)
+        goto fail;
+    mmio->trace_count = 0;
+    mmio->start_usec = avivo_get_usec();
+
+    if (mmio->sim_regs) {
+        mmio->backend = AVIVO_MMIO_SIM;
+        avivo_mmio_sim_seed(avivo);
+    } else {
+        mmio->backend = AVIVO_MMIO_RECORD;
+    }
+    mmio->hooked = TRUE;
+    xf86DrvMsg(screen_info->scrnIndex, X_CONFIG,
+               "using \"%s\" MMIO backend\n", backend);
+    return TRUE;
+
+fail:
+    xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
+               "Couldn't allocate MMIO backend \"%s\"\n", backend);
+    avivo_mmio_fini(screen_info);
+    return FALSE;
+}
+
+void
+avivo_mmio_fini(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_mmio *mmio = &avivo->mmio;
+
+    mmio->hooked = FALSE;
+    mmio->backend = AVIVO_MMIO_HW;
+    xfree(mmio->sim_regs);
+    xfree(mmio->sim_mc);
+    xfree(mmio->trace);
+    xfree(mmio->stats);
+    mmio->sim_regs = NULL;
+    mmio->sim_mc = NULL;
+    mmio->trace = NULL;
+    mmio->stats = NULL;
+}
+
+void
+avivo_mmio_dump_trace(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_mmio *mmio = &avivo->mmio;
+    struct avivo_mmio_trace *trace;
+    unsigned long i, first;
+
+    if (mmio->trace == NULL)
+        return;
+
+    first = 0;
+    if (mmio->trace_count > AVIVO_MMIO_TRACE_SIZE)
+        first = mmio->trace_count - AVIVO_MMIO_TRACE_SIZE;
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "MMIO trace: %lu accesses, last %lu follow\n",
+               mmio->trace_count, mmio->trace_count - first);
+    for (i = first; i < mmio->trace_count; i++) {
+        trace = &mmio->trace[i % AVIVO_MMIO_TRACE_SIZE];
+        xf86DrvMsgVerb(screen_info->scrnIndex, X_INFO, 5,
+                       "%10luus %s %04x %08x\n", trace->usec,
+                       trace->write ? "W" : "R", trace->reg, trace->value);
+    }
+}
+
+#define AVIVO_MMIO_STATS_TOP 16
+
+void
+avivo_mmio_dump_stats(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_mmio_stats *stats = avivo->mmio.stats;
+    unsigned int top[AVIVO_MMIO_STATS_TOP];
+    unsigned long cost, best_cost;
+    int i, j, k, ntop;
+
+    if (stats == NULL)
+        return;
+
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "MMIO stats: %lu reads (%lu ns), %lu writes\n",
+               stats->total_reads, stats->total_read_ns,
+               stats->total_writes);
+    for (i = 0; i < AVIVO_MMIO_HIST_SIZE; i++) {
+        if (stats->read_hist[i] == 0)
+            continue;
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "  read %10luns-%10luns: %lu\n",
+                   1UL << i, (2UL << i) - 1, stats->read_hist[i]);
+    }
+
+    /* registers where the most time went, writes count as one ns each
+     * so that write-only hot spots still show up */
+    ntop = 0;
+    for (k = 0; k < AVIVO_MMIO_STATS_TOP; k++) {
+        best_cost = 0;
+        for (i = 0; i < AVIVO_MMIO_STATS_REGS; i++) {
+            cost = stats->read_ns[i] + stats->writes[i];
+            if (cost <= best_cost)
+                continue;
+            for (j = 0; j < ntop; j++)
+                if (top[j] == i)
+                    break;
+            if (j < ntop)
+                continue;
+            best_cost = cost;
+            top[ntop] = i;
+        }
+        if (best_cost == 0)
+            break;
+        ntop++;
+    }
+    for (k = 0; k < ntop; k++) {
+        i = top[k];
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "  reg %04x: %lu reads (%lu ns), %lu writes\n",
+                   i << 2, stats->reads[i], stats->read_ns[i],
+                   stats->writes[i]);
+    }
+
+    for (i = 0; i < AVIVO_MMIO_STATS_REGS; i++) {
+        if (stats->reads[i] == 0 && stats->writes[i] == 0)
+            continue;
+        xf86DrvMsgVerb(screen_info->scrnIndex, X_INFO, 5,
+                       "  reg %04x: %lu reads (%lu ns), %lu writes\n",
+                       i << 2, stats->reads[i], stats->read_ns[i],
+                       stats->writes[i]);
+    }
+}
+
+/*
+ * Summary for the debug property: total reads, total writes, total read
+ * time in microseconds, then the read histogram.  Returns how many
+ * values were filled in.
+ */
+int
+avivo_mmio_get_stats(ScrnInfoPtr screen_info, INT32 *values, int count)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_mmio_stats *stats = avivo->mmio.stats;
+    int i, n = 0;
+
+    if (stats == NULL || count < 3)
+        return 0;
+    values[n++] = stats->total_reads;
+    values[n++] = stats->total_writes;
+    values[n++] = stats->total_read_ns / 1000;
+    for (i = 0; i < AVIVO_MMIO_HIST_SIZE && n < count; i++)
+        values[n++] = stats->read_hist[i];
+    return n;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo mode validation: refuse anything the crtc can't actually
+ * scan out, before it reaches the hardware.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+
+#include "avivo.h"
+
+static int
+avivo_mode_cpp(ScrnInfoPtr screen_info)
+{
+    return (screen_info->bitsPerPixel + 7) / 8;
+}
+
+/* what the watermark code needs to know of a crtc scanning out mode */
+void
+avivo_mode_wm_head(ScrnInfoPtr screen_info, DisplayModePtr mode,
+                   struct avivo_wm_head *head)
+{
+    head->clock = mode->Clock;
+    head->hdisplay = mode->HDisplay;
+    head->htotal = mode->HTotal;
+    head->cpp = avivo_mode_cpp(screen_info);
+}
+
+ModeStatus
+avivo_mode_validate(ScrnInfoPtr screen_info, DisplayModePtr mode)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_wm_params params;
+    struct avivo_wm wm;
+    struct avivo_pll pll;
+    int pitch;
+
+    if (mode->Flags & V_DBLSCAN)
+        return MODE_NO_DBLESCAN;
+
+    if (mode->Clock < AVIVO_CRTC_MIN_CLOCK)
+        return MODE_CLOCK_LOW;
+    if (!avivo_pll_cache_get(&avivo->pll_cache, mode->Clock, &pll))
+        return MODE_CLOCK_RANGE;
+
+    /* every value mode_set programs must fit its register field */
+    if (mode->HTotal - 1 > AVIVO_CRTC_TIMING_MAX ||
+        mode->HTotal - mode->HSyncStart + mode->HDisplay >
+        AVIVO_CRTC_TIMING_MAX ||
+        mode->HSyncEnd - mode->HSyncStart > AVIVO_CRTC_TIMING_MAX ||
+        mode->HSyncStart < mode->HDisplay || mode->HSyncEnd > mode->HTotal)
+        return MODE_BAD_HVALUE;
+    if (mode->VTotal - 1 > AVIVO_CRTC_TIMING_MAX ||
+        mode->VTotal - mode->VSyncStart + mode->VDisplay >
+        AVIVO_CRTC_TIMING_MAX ||
+        mode->VSyncEnd - mode->VSyncStart > AVIVO_CRTC_TIMING_MAX ||
+        mode->VSyncStart < mode->VDisplay || mode->VSyncEnd > mode->VTotal)
+        return MODE_BAD_VVALUE;
+
+    /* scanout pitch is padded, see avivo_screen_init() */
+    pitch = (mode->HDisplay + AVIVO_CRTC_PITCH_ALIGN - 1) &
+            ~(AVIVO_CRTC_PITCH_ALIGN - 1);
+    if (pitch > AVIVO_CRTC_TIMING_MAX + 1)
+        return MODE_BAD_WIDTH;
+    if ((long long)pitch * mode->VDisplay * avivo_mode_cpp(screen_info) >
+        avivo->fb_size)
+        return MODE_MEM;
+
+    /* alone on the chip; the server we build against predates
+     * MODE_BANDWIDTH */
+    memset(&params, 0, sizeof(params));
+    params.mclk = avivo->mclk;
+    avivo_mode_wm_head(screen_info, mode, &params.head[0]);
+    if (!avivo_wm_compute(&params, &wm))
+        return MODE_CLOCK_HIGH;
+
+    return MODE_OK;
+}
+
+/*
+ * Can memory, at the probed clock, feed this mode next to what the
+ * other enabled crtcs already scan out?
+ */
+Bool
+avivo_mode_bandwidth_ok(xf86CrtcPtr crtc, DisplayModePtr mode)
+{
+    ScrnInfoPtr screen_info = crtc->scrn;
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_wm_params params;
+    struct avivo_wm wm;
+    int i;
+
+    memset(&params, 0, sizeof(params));
+    params.mclk = avivo->mclk;
+    for (i = 0; i < config->num_crtc && i < 2; i++) {
+        xf86CrtcPtr other = config->crtc[i];
+        struct avivo_crtc_private *avivo_crtc = other->driver_private;
+        struct avivo_wm_head *head = &params.head[avivo_crtc->crtc_number];
+
+        if (other == crtc)
+            avivo_mode_wm_head(screen_info, mode, head);
+        else if (other->enabled)
+            avivo_mode_wm_head(screen_info, &other->mode, head);
+    }
+    return avivo_wm_compute(&params, &wm);
+}
+
+void
+avivo_mode_key(DisplayModePtr mode, int *key)
+{
+    key[0] = mode->Clock;
+    key[1] = mode->HDisplay;
+    key[2] = mode->HSyncStart;
+    key[3] = mode->HSyncEnd;
+    key[4] = mode->HTotal;
+    key[5] = mode->VDisplay;
+    key[6] = mode->VSyncStart;
+    key[7] = mode->VSyncEnd;
+    key[8] = mode->VTotal;
+    key[9] = mode->Flags;
+}
+
+static unsigned int
+avivo_mode_hash(xf86OutputPtr output, const int *key)
+{
+    unsigned int hash = 2166136261u ^ (unsigned int)(unsigned long)output;
+    int i;
+
+    for (i = 0; i < AVIVO_MODE_KEY_SIZE; i++) {
+        hash ^= (unsigned int)key[i];
+        hash *= 16777619u;
+    }
+    return hash % AVIVO_MODE_CACHE_SIZE;
+}
+
+/*
+ * Verdicts only depend on the timings and on things fixed at
+ * PreInit (fb size, depth), so they are kept per output and timing
+ * set.  A monitor reprobe then costs a hash lookup per EDID mode.
+ */
+ModeStatus
+avivo_mode_valid_cached(xf86OutputPtr output, DisplayModePtr mode)
+{
+    struct avivo_info *avivo = avivo_get_info(output->scrn);
+    struct avivo_mode_cache *cache = &avivo->mode_cache;
+    struct avivo_mode_verdict *verdict;
+    int key[AVIVO_MODE_KEY_SIZE];
+
+    avivo_mode_key(mode, key);
+    verdict = &cache->verdict[avivo_mode_hash(output, key)];
+    if (verdict->output == output &&
+        !memcmp(verdict->key, key, sizeof(key))) {
+        cache->hits++;
+        return verdict->status;
+    }
+    cache->misses++;
+    verdict->output = output;
+    memcpy(verdict->key, key, sizeof(key));
+    verdict->status = avivo_mode_validate(output->scrn, mode);
+    return verdict->status;
+}
+
+void
+avivo_mode_cache_invalidate(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    int i;
+
+    for (i = 0; i < AVIVO_MODE_CACHE_SIZE; i++)
+        avivo->mode_cache.verdict[i].output = NULL;
+}
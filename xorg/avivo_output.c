@@ -28,6 +28,7 @@
 /* DPMS */
 #define DPMS_SERVER
 #include <X11/extensions/dpms.h>
+#include <X11/Xatom.h>
 #include <unistd.h>
 
 #include "avivo.h"
@@ -96,7 +97,7 @@ avivo_output_tmds1_setup(xf86OutputPtr output)
     OUTREG(AVIVO_TMDSA_TRANSMITTER_ENABLE, (AVIVO_TMDSA_TRANSMITTER_ENABLE_TX0_ENABLE | AVIVO_TMDSA_TRANSMITTER_ENABLE_LNKC0EN | AVIVO_TMDSA_TRANSMITTER_ENABLE_LNKD00EN | AVIVO_TMDSA_TRANSMITTER_ENABLE_LNKD01EN | AVIVO_TMDSA_TRANSMITTER_ENABLE_LNKD02EN));
 
     /* FIXME - this should be set from scratch, not just read and reset */
-    OUTREG(AVIVO_TMDSA_CNTL, (INREG(AVIVO_TMDSA_CNTL) | AVIVO_TMDSA_CNTL_ENABLE));
+    avivo_reg_rmw(avivo, AVIVO_TMDSA_CNTL, 0, AVIVO_TMDSA_CNTL_ENABLE);
     OUTREG(AVIVO_TMDSA_DCBALANCER_CONTROL, AVIVO_TMDSA_DCBALANCER_CONTROL_EN);
     OUTREG(AVIVO_TMDSA_TRANSMITTER_CONTROL, tmp);
     OUTREG(AVIVO_TMDSA_TRANSMITTER_CONTROL, tmp | (AVIVO_TMDSA_TRANSMITTER_CONTROL_PLL_ENABLE | AVIVO_TMDSA_TRANSMITTER_CONTROL_PLL_RESET));
@@ -141,7 +142,7 @@ avivo_output_tmds2_setup(xf86OutputPtr output)
 					    AVIVO_LVTMA_TRANSMITTER_ENABLE_LNKD11EN | 
 					    AVIVO_LVTMA_TRANSMITTER_ENABLE_LNKD12EN));
 
-    OUTREG(AVIVO_LVTMA_CNTL, (INREG(AVIVO_LVTMA_CNTL) | AVIVO_LVTMA_CNTL_ENABLE));
+    avivo_reg_rmw(avivo, AVIVO_LVTMA_CNTL, 0, AVIVO_LVTMA_CNTL_ENABLE);
     OUTREG(AVIVO_LVTMA_DCBALANCER_CONTROL, AVIVO_LVTMA_DCBALANCER_CONTROL_EN);
 
     /* FIXME: Bonghits? Make really sure we reenable the PLLs*/
@@ -265,7 +266,7 @@ avivo_output_lvds_dpms(xf86OutputPtr output, int mode)
             AVIVO_LVTMA_PWRSEQ_PLL_ENABLE_MASK |
             AVIVO_LVTMA_PWRSEQ_PLL_RESET_MASK);
         do {
-            tmp = INREG(AVIVO_LVTMA_PWRSEQ_STATE);
+            tmp = avivo_reg_read(avivo, AVIVO_LVTMA_PWRSEQ_STATE);
             usleep(100);
         } while (tmp != 0x8 << AVIVO_LVTMA_PWRSEQ_STATE_STATUS_SHIFT);
         OUTREG(AVIVO_LVTMA_TRANSMITTER_ENABLE, 0);
@@ -284,6 +285,8 @@ avivo_output_dpms(xf86OutputPtr output, int mode)
     /* try to grab card lock or at least somethings that looks like a lock
      * if it fails more than 5 times with 1000ms wait btw each try than we
      * assume we can process.
+     * The lock is shared with whoever else drives the card, so it never
+     * goes through the register shadow.
      */
     count = 0;
     tmp = INREG(0x0028);
@@ -310,13 +313,7 @@ avivo_output_dpms(xf86OutputPtr output, int mode)
 static int
 avivo_output_mode_valid(xf86OutputPtr output, DisplayModePtr pMode)
 {
-    if (pMode->Flags & V_DBLSCAN)
-        return MODE_NO_DBLESCAN;
-
-    if (pMode->Clock > 400000 || pMode->Clock < 25000)
-        return MODE_CLOCK_RANGE;
-
-    return MODE_OK;
+    return avivo_mode_valid_cached(output, pMode);
 }
 
 static Bool
@@ -344,12 +341,60 @@ static void
 avivo_output_commit(xf86OutputPtr output)
 {
     struct avivo_output_private *avivo_output = output->driver_private;
+    struct avivo_info *avivo = avivo_get_info(output->scrn);
 
+    /* the crtc isn't programmed yet, see avivo_crtc_batch_end() */
+    if (avivo->crtc_batch) {
+        avivo_output->pending = TRUE;
+        return;
+    }
     if (avivo_output->setup)
         avivo_output->setup(output);
     output->funcs->dpms(output, DPMSModeOn);
 }
 
+/*
+ * Run the output commits held back during a crtc batch, once the crtcs
+ * scan out their new mode; with enable FALSE the outputs stay off.
+ */
+void
+avivo_output_commit_pending(ScrnInfoPtr screen_info, Bool enable)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_output_private *avivo_output;
+    int i;
+
+    for (i = 0; i < config->num_output; i++) {
+        xf86OutputPtr output = config->output[i];
+
+        avivo_output = output->driver_private;
+        if (!avivo_output->pending)
+            continue;
+        avivo_output->pending = FALSE;
+        if (enable)
+            avivo_output_commit(output);
+    }
+}
+
+/*
+ * Commit every output on an enabled crtc again, for when the crtcs are
+ * kept as they are but whoever had the chip may have turned the
+ * outputs off or reprogrammed them.
+ */
+void
+avivo_output_commit_enabled(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    int i;
+
+    for (i = 0; i < config->num_output; i++) {
+        xf86OutputPtr output = config->output[i];
+
+        if (output->crtc != NULL && output->crtc->enabled)
+            avivo_output_commit(output);
+    }
+}
+
 static xf86OutputStatus
 avivo_output_detect_ddc_dac(xf86OutputPtr output)
 {
@@ -424,11 +469,76 @@ avivo_output_destroy(xf86OutputPtr output)
 
     if (avivo_output == NULL)
         return;
+    /* verdicts are keyed on the output pointer */
+    avivo_mode_cache_invalidate(output->scrn);
     xf86DestroyI2CBusRec(avivo_output->i2c, TRUE, TRUE);
     xfree(avivo_output->name);
     xfree(avivo_output);
 }
 
+#ifdef RANDR_12_INTERFACE
+/*
+ * AVIVO_MMIO_STATS: only there with Option "MMIOStats".  Reading it
+ * gives the counters from avivo_mmio_get_stats(), writing anything to
+ * it dumps the full per-register summary to the log.
+ */
+#define AVIVO_MMIO_STATS_NAME "AVIVO_MMIO_STATS"
+#define AVIVO_MMIO_STATS_VALUES (3 + AVIVO_MMIO_HIST_SIZE)
+
+static Atom mmio_stats_atom;
+
+static Bool
+avivo_output_update_mmio_stats(xf86OutputPtr output)
+{
+    INT32 values[AVIVO_MMIO_STATS_VALUES];
+    int count, err;
+
+    count = avivo_mmio_get_stats(output->scrn, values,
+                                 AVIVO_MMIO_STATS_VALUES);
+    err = RRChangeOutputProperty(output->randr_output, mmio_stats_atom,
+                                 XA_INTEGER, 32, PropModeReplace,
+                                 count, values, FALSE, FALSE);
+    return err == Success;
+}
+
+static void
+avivo_output_create_resources(xf86OutputPtr output)
+{
+    struct avivo_info *avivo = avivo_get_info(output->scrn);
+    int err;
+
+    if (avivo->mmio.stats == NULL)
+        return;
+
+    mmio_stats_atom = MakeAtom(AVIVO_MMIO_STATS_NAME,
+                               sizeof(AVIVO_MMIO_STATS_NAME) - 1, TRUE);
+    err = RRConfigureOutputProperty(output->randr_output, mmio_stats_atom,
+                                    FALSE, FALSE, FALSE, 0, NULL);
+    if (err != Success || !avivo_output_update_mmio_stats(output))
+        xf86DrvMsg(output->scrn->scrnIndex, X_ERROR,
+                   "Failed to create %s property\n", AVIVO_MMIO_STATS_NAME);
+}
+
+static Bool
+avivo_output_set_property(xf86OutputPtr output, Atom property,
+                          RRPropertyValuePtr value)
+{
+    if (property == mmio_stats_atom)
+        avivo_mmio_dump_stats(output->scrn);
+    return TRUE;
+}
+#endif
+
+#ifdef RANDR_13_INTERFACE
+static Bool
+avivo_output_get_property(xf86OutputPtr output, Atom property)
+{
+    if (property == mmio_stats_atom)
+        return avivo_output_update_mmio_stats(output);
+    return TRUE;
+}
+#endif
+
 static const xf86OutputFuncsRec avivo_output_dac_funcs = {
     .dpms = avivo_output_dpms,
     .save = NULL,
@@ -440,6 +550,13 @@ static const xf86OutputFuncsRec avivo_output_dac_funcs = {
     .commit = avivo_output_commit,
     .detect = avivo_output_detect_ddc_dac,
     .get_modes = avivo_output_get_modes,
+#ifdef RANDR_12_INTERFACE
+    .create_resources = avivo_output_create_resources,
+    .set_property = avivo_output_set_property,
+#endif
+#ifdef RANDR_13_INTERFACE
+    .get_property = avivo_output_get_property,
+#endif
     .destroy = avivo_output_destroy
 };
 
@@ -454,6 +571,13 @@ static const xf86OutputFuncsRec avivo_output_tmds_funcs = {
     .commit = avivo_output_commit,
     .detect = avivo_output_detect_ddc_tmds,
     .get_modes = avivo_output_get_modes,
+#ifdef RANDR_12_INTERFACE
+    .create_resources = avivo_output_create_resources,
+    .set_property = avivo_output_set_property,
+#endif
+#ifdef RANDR_13_INTERFACE
+    .get_property = avivo_output_get_property,
+#endif
     .destroy = avivo_output_destroy
 };
 
@@ -468,6 +592,13 @@ static const xf86OutputFuncsRec avivo_output_lfp_funcs = {
     .commit = avivo_output_commit,
     .detect = avivo_output_detect_ddc_lfp,
     .get_modes = avivo_output_lfp_get_modes,
+#ifdef RANDR_12_INTERFACE
+    .create_resources = avivo_output_create_resources,
+    .set_property = avivo_output_set_property,
+#endif
+#ifdef RANDR_13_INTERFACE
+    .get_property = avivo_output_get_property,
+#endif
     .destroy = avivo_output_destroy
 };
 
@@ -0,0 +1,153 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo PLL divider solver.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "avivo_pll.h"
+#ifndef AVIVO_PLL_GEN
+#include "avivo_pll_table.h"
+#endif
+
+/*
+ * Find the dividers giving the clock closest to the target (kHz).  All
+ * integer: for each divider pair only the two multipliers around the
+ * exact ratio can be best.  Errors are compared as fractions so nothing
+ * is lost to rounding; on a tie the larger divider product wins, as it
+ * did with the old floating point search.  Returns 1 if the result is
+ * within AVIVO_PLL_MAX_PPM of the target, 0 otherwise (pll still holds
+ * the closest we can do).
+ */
+int
+avivo_pll_solve(int clock, struct avivo_pll *pll)
+{
+    long long err, best_err = -1, target;
+    int post_div, div, n, best_n = 1, mul, i;
+
+    pll->post_div = pll->div = pll->mul = 0;
+    pll->clock = 0;
+    pll->ppm = 1000000;
+    if (clock <= 0)
+        return 0;
+
+    for (post_div = AVIVO_PLL_POST_DIV_MIN;
+         post_div <= AVIVO_PLL_POST_DIV_MAX; post_div++) {
+        for (div = post_div + 1; div < post_div + AVIVO_PLL_DIV_SPAN; div++) {
+            n = post_div * div;
+            if (n <= AVIVO_PLL_MIN_PRODUCT)
+                continue;
+            /* error is |mul * ref - clock * n| / n */
+            target = (long long)clock * n;
+            for (i = 0; i < 2; i++) {
+                mul = target / AVIVO_PLL_REF + i;
+                if (mul < 1)
+                    mul = 1;
+                if (mul > AVIVO_PLL_MUL_MAX)
+                    mul = AVIVO_PLL_MUL_MAX;
+                err = (long long)mul * AVIVO_PLL_REF - target;
+                if (err < 0)
+                    err = -err;
+                if (best_err >= 0 &&
+                    (err * best_n > best_err * n ||
+                     (err * best_n == best_err * n && n <= best_n)))
+                    continue;
+                best_err = err;
+                best_n = n;
+                pll->post_div = post_div;
+                pll->div = div;
+                pll->mul = mul;
+            }
+        }
+    }
+
+    pll->clock = ((long long)pll->mul * AVIVO_PLL_REF + best_n / 2) / best_n;
+    pll->ppm = best_err * 1000000 / ((long long)clock * best_n);
+    return pll->ppm <= AVIVO_PLL_MAX_PPM;
+}
+
+#ifndef AVIVO_PLL_GEN
+/*
+ * Look the clock up in the table built by avivo_pll_gen.  Returns 1 and
+ * fills pll if it is there.
+ */
+int
+avivo_pll_table_find(int clock, struct avivo_pll *pll)
+{
+    int lo = 0, hi = sizeof(avivo_pll_table) / sizeof(avivo_pll_table[0]);
+    int mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (avivo_pll_table[mid].target == clock) {
+            *pll = avivo_pll_table[mid].pll;
+            return 1;
+        }
+        if (avivo_pll_table[mid].target < clock)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+/* avivo_pll_solve(), from the standard clock table when possible */
+int
+avivo_pll_get(int clock, struct avivo_pll *pll)
+{
+    if (avivo_pll_table_find(clock, pll))
+        return pll->ppm <= AVIVO_PLL_MAX_PPM;
+    return avivo_pll_solve(clock, pll);
+}
+
+/*
+ * avivo_pll_get() through a small cache keyed by target clock; a
+ * handful of clocks cover nearly every mode set.  Oldest entry goes
+ * first.
+ */
+int
+avivo_pll_cache_get(struct avivo_pll_cache *cache, int clock,
+                    struct avivo_pll *pll)
+{
+    int i;
+
+    for (i = 0; i < cache->count; i++) {
+        if (cache->target[i] == clock) {
+            cache->hits++;
+            *pll = cache->pll[i];
+            return pll->ppm <= AVIVO_PLL_MAX_PPM;
+        }
+    }
+
+    cache->misses++;
+    avivo_pll_get(clock, pll);
+    i = cache->next;
+    cache->target[i] = clock;
+    cache->pll[i] = *pll;
+    cache->next = (i + 1) % AVIVO_PLL_CACHE_SIZE;
+    if (cache->count < AVIVO_PLL_CACHE_SIZE)
+        cache->count++;
+    return pll->ppm <= AVIVO_PLL_MAX_PPM;
+}
+#endif
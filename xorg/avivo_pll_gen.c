@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * Generator for avivo_pll_table.h: runs avivo_pll_solve() over the
+ * pixel clocks of the VESA DMT, CVT (normal and reduced blanking) and
+ * CEA-861 modes and prints the result as a sorted const table.  Clocks
+ * it can't get within AVIVO_PLL_MAX_PPM of are left out, lookups for
+ * them fall through to the solver, which turns them down.  The
+ * table is committed, so builds never run this; "make pll-table"
+ * regenerates it after the solver or the clock list changes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avivo_pll.h"
+
+/* kHz */
+static const int standard_clocks[] = {
+    /* CEA-861 */
+    25175, 25200, 27000, 27027, 54000, 54054, 74176, 74250,
+    148352, 148500, 296703, 297000,
+    /* VESA DMT */
+    31500, 36000, 40000, 49500, 50000, 56250, 65000, 75000, 78750,
+    94500, 108000, 121750, 135000, 146250, 157500, 162000, 175500,
+    189000, 202500, 204750, 229500, 234000, 261000, 268250, 281250,
+    297000,
+    /* CVT */
+    33750, 44900, 79500, 83500, 85500, 101250, 106500, 117500, 122500,
+    136750, 140250, 173000, 187250, 193250, 245250, 268500, 348500,
+    /* CVT reduced blanking */
+    68250, 71000, 72250, 88750, 97750, 101000, 119000, 138500, 154000,
+    162250, 205250, 241500, 268000,
+};
+
+static int
+compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int
+main(void)
+{
+    int clocks[sizeof(standard_clocks) / sizeof(standard_clocks[0])];
+    int count = sizeof(standard_clocks) / sizeof(standard_clocks[0]);
+    struct avivo_pll pll;
+    int i;
+
+    for (i = 0; i < count; i++)
+        clocks[i] = standard_clocks[i];
+    qsort(clocks, count, sizeof(clocks[0]), compare_int);
+
+    printf("/* generated by avivo_pll_gen (make pll-table), do not edit */\n");
+    printf("static const struct {\n"
+           "    int target;\n"
+           "    struct avivo_pll pll;\n"
+           "} avivo_pll_table[] = {\n");
+    for (i = 0; i < count; i++) {
+        if (i > 0 && clocks[i] == clocks[i - 1])
+            continue;
+        if (!avivo_pll_solve(clocks[i], &pll))
+            continue;
+        printf("    { %6d, { %d, %2d, %3d, %6d, %6d } },\n", clocks[i],
+               pll.post_div, pll.div, pll.mul, pll.clock, pll.ppm);
+    }
+    printf("};\n");
+    return 0;
+}
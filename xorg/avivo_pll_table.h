@@ -0,0 +1,72 @@
+/* generated by avivo_pll_gen (make pll-table), do not edit */
+static const struct {
+    int target;
+    struct avivo_pll pll;
+} avivo_pll_table[] = {
+    {  25175, { 4, 11,  41,  25159,    631 } },
+    {  25200, { 5, 18,  84,  25200,      0 } },
+    {  27000, { 6, 19, 114,  27000,      0 } },
+    {  27027, { 6, 19, 114,  27000,    999 } },
+    {  31500, { 6, 19, 133,  31500,      0 } },
+    {  33750, { 6, 18, 135,  33750,      0 } },
+    {  36000, { 6, 19, 152,  36000,      0 } },
+    {  40000, { 6, 18, 160,  40000,      0 } },
+    {  44900, { 5, 16, 133,  44888,    278 } },
+    {  49500, { 6, 19, 209,  49500,      0 } },
+    {  50000, { 6, 18, 200,  50000,      0 } },
+    {  54000, { 6, 19, 228,  54000,      0 } },
+    {  54054, { 6, 19, 228,  54000,    999 } },
+    {  56250, { 6, 18, 225,  56250,      0 } },
+    {  65000, { 6,  9, 130,  65000,      0 } },
+    {  68250, { 6, 12, 182,  68250,      0 } },
+    {  71000, { 6,  9, 142,  71000,      0 } },
+    {  72250, { 4, 17, 182,  72265,    203 } },
+    {  74176, { 5, 15, 206,  74160,    215 } },
+    {  74250, { 6, 14, 231,  74250,      0 } },
+    {  75000, { 5, 18, 250,  75000,      0 } },
+    {  78750, { 6, 14, 245,  78750,      0 } },
+    {  79500, { 6, 12, 212,  79500,      0 } },
+    {  83500, { 6,  9, 167,  83500,      0 } },
+    {  85500, { 6, 13, 247,  85500,      0 } },
+    {  88750, { 6, 11, 217,  88773,    256 } },
+    {  94500, { 6, 12, 252,  94500,      0 } },
+    {  97750, { 5, 10, 181,  97740,    102 } },
+    { 101000, { 6,  9, 202, 101000,      0 } },
+    { 101250, { 4, 17, 255, 101250,      0 } },
+    { 106500, { 6,  9, 213, 106500,      0 } },
+    { 108000, { 4, 15, 240, 108000,      0 } },
+    { 117500, { 6,  9, 235, 117500,      0 } },
+    { 119000, { 6,  9, 238, 119000,      0 } },
+    { 121750, { 5, 11, 248, 121745,     37 } },
+    { 122500, { 6,  9, 245, 122500,      0 } },
+    { 135000, { 5, 10, 250, 135000,      0 } },
+    { 136750, { 3, 15, 228, 136800,    365 } },
+    { 138500, { 3, 13, 200, 138462,    277 } },
+    { 140250, { 3, 12, 187, 140250,      0 } },
+    { 146250, { 3, 12, 195, 146250,      0 } },
+    { 148352, { 4, 11, 242, 148500,    997 } },
+    { 148500, { 4, 11, 242, 148500,      0 } },
+    { 154000, { 3,  9, 154, 154000,      0 } },
+    { 157500, { 3, 14, 245, 157500,      0 } },
+    { 162000, { 3, 14, 252, 162000,      0 } },
+    { 162250, { 3, 14, 252, 162000,   1540 } },
+    { 173000, { 3,  9, 173, 173000,      0 } },
+    { 175500, { 3, 12, 234, 175500,      0 } },
+    { 187250, { 2, 15, 208, 187200,    267 } },
+    { 189000, { 3, 12, 252, 189000,      0 } },
+    { 193250, { 4,  8, 229, 193219,    161 } },
+    { 202500, { 4,  8, 240, 202500,      0 } },
+    { 204750, { 2, 12, 182, 204750,      0 } },
+    { 205250, { 2, 15, 228, 205200,    243 } },
+    { 229500, { 2, 15, 255, 229500,      0 } },
+    { 234000, { 3,  9, 234, 234000,      0 } },
+    { 241500, { 3,  7, 188, 241714,    887 } },
+    { 245250, { 2, 12, 218, 245250,      0 } },
+    { 261000, { 2, 12, 232, 261000,      0 } },
+    { 268000, { 2, 12, 238, 267750,    932 } },
+    { 268250, { 3,  7, 209, 268714,   1730 } },
+    { 268500, { 3,  7, 209, 268714,    798 } },
+    { 281250, { 2, 12, 250, 281250,      0 } },
+    { 296703, { 2, 11, 242, 297000,   1001 } },
+    { 297000, { 2, 11, 242, 297000,      0 } },
+};
@@ -0,0 +1,550 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo shadow frame buffer: push what the damage layer saw change to
+ * VRAM, box by box, with the best copy the CPU has.  Optionally hold
+ * it back so that the screen is written at most once per frame.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+#include <sys/mman.h>
+
+#include "shadow.h"
+
+#include "avivo.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* avivo_shadow_tiles.state */
+#define AVIVO_TILE_VALID    (1 << 0)
+#define AVIVO_TILE_CHANGED  (1 << 1)
+
+/*
+ * Pick the copy, "auto" or NULL for the fastest one, and how many
+ * threads share a large flush.
+ */
+void
+avivo_shadow_setup(ScrnInfoPtr screen_info, const char *copy, int threads)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+
+    shadow->blit = avivo_blit_find(copy);
+    if (shadow->blit == NULL) {
+        xf86DrvMsg(screen_info->scrnIndex, X_WARNING,
+                   "shadow copy \"%s\" not available here\n", copy);
+        shadow->blit = avivo_blit_find(NULL);
+    }
+    xf86DrvMsg(screen_info->scrnIndex, copy ? X_CONFIG : X_PROBED,
+               "using \"%s\" shadow copy\n", shadow->blit->name);
+
+    if (threads > AVIVO_BLIT_MAX_THREADS)
+        threads = AVIVO_BLIT_MAX_THREADS;
+    shadow->threads = threads > 1 ? threads : 1;
+}
+
+/*
+ * The shadow at the pitch fb draws with, the padded displayWidth: a
+ * multiple of 256 pixels, so with the buffer page aligned every row
+ * starts on a cache line.  It is mapped on a huge page boundary and
+ * rounded to whole huge pages so that all of it can use them.  Fresh
+ * anonymous pages read as zero without being cleared up front, the
+ * first flush and the root window paint touch them anyway.
+ */
+void *
+avivo_shadow_alloc(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+    unsigned long size, pitch, head, tail;
+    unsigned char *map, *start;
+
+    pitch = screen_info->displayWidth * avivo->bpp;
+    size = (pitch * screen_info->virtualY + AVIVO_SHADOW_HUGE_PAGE - 1) &
+           ~(AVIVO_SHADOW_HUGE_PAGE - 1);
+    map = mmap(NULL, size + AVIVO_SHADOW_HUGE_PAGE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    /* keep the huge page aligned part */
+    start = (unsigned char *)(((unsigned long)map + AVIVO_SHADOW_HUGE_PAGE -
+                               1) & ~(AVIVO_SHADOW_HUGE_PAGE - 1));
+    head = start - map;
+    tail = AVIVO_SHADOW_HUGE_PAGE - head;
+    if (head)
+        munmap(map, head);
+    if (tail)
+        munmap(start + size, tail);
+#ifdef MADV_HUGEPAGE
+    if (madvise(start, size, MADV_HUGEPAGE))
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "no huge pages for the shadow\n");
+#endif
+    shadow->map = start;
+    shadow->map_size = size;
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "shadow: %lu kB, pitch %lu\n", size / 1024, pitch);
+    return start;
+}
+
+void
+avivo_shadow_free(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+
+    if (shadow->map)
+        munmap(shadow->map, shadow->map_size);
+    shadow->map = NULL;
+    shadow->map_size = 0;
+}
+
+static void
+avivo_shadow_tiles_fini(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow_tiles *tiles = &avivo->shadow.tiles;
+
+    xfree(tiles->hash);
+    xfree(tiles->checked);
+    xfree(tiles->state);
+    xfree(tiles->boxes);
+    tiles->hash = NULL;
+    tiles->checked = NULL;
+    tiles->state = NULL;
+    tiles->boxes = NULL;
+    tiles->boxes_size = 0;
+}
+
+static Bool
+avivo_shadow_tiles_init(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow_tiles *tiles = &avivo->shadow.tiles;
+    int count;
+
+    /* the padded pitch is a whole number of tiles */
+    tiles->width = screen_info->displayWidth / AVIVO_SHADOW_TILE;
+    tiles->height = (screen_info->virtualY + AVIVO_SHADOW_TILE - 1) /
+                    AVIVO_SHADOW_TILE;
+    count = tiles->width * tiles->height;
+    tiles->hash = xcalloc(count, sizeof(tiles->hash[0]));
+    tiles->checked = xcalloc(count, sizeof(tiles->checked[0]));
+    tiles->state = xcalloc(count, sizeof(tiles->state[0]));
+    if (tiles->hash == NULL || tiles->checked == NULL ||
+        tiles->state == NULL) {
+        xf86DrvMsg(screen_info->scrnIndex, X_ERROR,
+                   "Couldn't allocate shadow tiles\n");
+        avivo_shadow_tiles_fini(screen_info);
+        return FALSE;
+    }
+    tiles->flush = 0;
+    xf86DrvMsg(screen_info->scrnIndex, X_CONFIG,
+               "skipping unchanged %dx%d shadow tiles\n",
+               AVIVO_SHADOW_TILE, AVIVO_SHADOW_TILE);
+    return TRUE;
+}
+
+/* VRAM may no longer hold what we flushed, e.g. after a VT switch */
+void
+avivo_shadow_tiles_invalidate(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow_tiles *tiles = &avivo->shadow.tiles;
+
+    if (tiles->state)
+        memset(tiles->state, 0, tiles->width * tiles->height);
+}
+
+/* hash tile t, once per flush; TRUE if it differs from VRAM */
+static Bool
+avivo_shadow_tile_changed(ScrnInfoPtr screen_info, int tx, int ty)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+    struct avivo_shadow_tiles *tiles = &shadow->tiles;
+    int t = ty * tiles->width + tx;
+    int pitch, rows, y = ty * AVIVO_SHADOW_TILE;
+    unsigned long long hash;
+
+    if (tiles->checked[t] == tiles->flush)
+        return tiles->state[t] & AVIVO_TILE_CHANGED;
+    pitch = screen_info->displayWidth * avivo->bpp;
+    rows = screen_info->virtualY - y;
+    if (rows > AVIVO_SHADOW_TILE)
+        rows = AVIVO_SHADOW_TILE;
+    hash = shadow->blit->hash((unsigned char *)avivo->fb_shadow + y * pitch +
+                              tx * AVIVO_SHADOW_TILE * avivo->bpp,
+                              pitch, AVIVO_SHADOW_TILE * avivo->bpp, rows);
+    tiles->checked[t] = tiles->flush;
+    tiles->tiles_checked++;
+    if ((tiles->state[t] & AVIVO_TILE_VALID) && tiles->hash[t] == hash) {
+        tiles->state[t] = AVIVO_TILE_VALID;
+        tiles->tiles_skipped++;
+        return FALSE;
+    }
+    /* the damage in it is about to be copied, VRAM will match */
+    tiles->hash[t] = hash;
+    tiles->state[t] = AVIVO_TILE_VALID | AVIVO_TILE_CHANGED;
+    return TRUE;
+}
+
+/*
+ * Cut the boxes along the tiles and keep the pieces in tiles that
+ * changed since they were flushed.  Returns the number of boxes left
+ * in tiles->boxes, -1 if we ran out of memory.
+ */
+static int
+avivo_shadow_tiles_filter(ScrnInfoPtr screen_info, BoxPtr box, int nbox)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow_tiles *tiles = &avivo->shadow.tiles;
+    unsigned long start = avivo_get_usec();
+    BoxRec piece;
+    BoxPtr boxes;
+    int n = 0, tx, ty, size;
+
+    tiles->flush++;
+    for (; nbox--; box++) {
+        for (ty = box->y1 / AVIVO_SHADOW_TILE;
+             ty <= (box->y2 - 1) / AVIVO_SHADOW_TILE; ty++) {
+            for (tx = box->x1 / AVIVO_SHADOW_TILE;
+                 tx <= (box->x2 - 1) / AVIVO_SHADOW_TILE; tx++) {
+                piece.x1 = max(box->x1, tx * AVIVO_SHADOW_TILE);
+                piece.y1 = max(box->y1, ty * AVIVO_SHADOW_TILE);
+                piece.x2 = min(box->x2, (tx + 1) * AVIVO_SHADOW_TILE);
+                piece.y2 = min(box->y2, (ty + 1) * AVIVO_SHADOW_TILE);
+                if (!avivo_shadow_tile_changed(screen_info, tx, ty)) {
+                    tiles->bytes_saved += (piece.x2 - piece.x1) *
+                                          (piece.y2 - piece.y1) * avivo->bpp;
+                    continue;
+                }
+                if (n == tiles->boxes_size) {
+                    size = tiles->boxes_size ? tiles->boxes_size * 2 : 256;
+                    boxes = xrealloc(tiles->boxes, size * sizeof(BoxRec));
+                    if (boxes == NULL)
+                        return -1;
+                    tiles->boxes = boxes;
+                    tiles->boxes_size = size;
+                }
+                tiles->boxes[n++] = piece;
+            }
+        }
+    }
+    tiles->hash_usec += avivo_get_usec() - start;
+    return n;
+}
+
+static void avivo_shadow_block_handler(pointer data, OSTimePtr timeout,
+                                       pointer read_mask);
+static void avivo_shadow_wakeup_handler(pointer data, int result,
+                                        pointer read_mask);
+
+void
+avivo_shadow_start(ScreenPtr screen)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+    int threads;
+
+    REGION_INIT(screen, &shadow->pending, NullBox, 0);
+    if (shadow->coalesce)
+        xf86DrvMsg(screen_info->scrnIndex, X_CONFIG,
+                   "shadow flushes once per frame, within %lu ms\n",
+                   shadow->max_latency_usec / 1000);
+    if (shadow->tile_check && !avivo_shadow_tiles_init(screen_info))
+        shadow->tile_check = FALSE;
+    threads = avivo_blit_pool_init(&shadow->pool, shadow->threads);
+    if (threads < shadow->threads)
+        xf86DrvMsg(screen_info->scrnIndex, X_WARNING,
+                   "only %d of %d shadow copy threads started\n",
+                   threads, shadow->threads);
+    else if (threads > 1)
+        xf86DrvMsg(screen_info->scrnIndex, X_CONFIG,
+                   "shadow copies in %d bands\n", threads);
+}
+
+void
+avivo_shadow_stop(ScreenPtr screen)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+
+    if (avivo->shadow.registered) {
+        RemoveBlockAndWakeupHandlers(avivo_shadow_block_handler,
+                                     avivo_shadow_wakeup_handler, screen);
+        avivo->shadow.registered = FALSE;
+    }
+    avivo_blit_pool_fini(&avivo->shadow.pool);
+    REGION_UNINIT(screen, &avivo->shadow.pending);
+    avivo_shadow_tiles_fini(screen_info);
+}
+
+/* the enabled crtc with the shortest frame, and that frame in usec */
+static xf86CrtcPtr
+avivo_shadow_pace_crtc(ScrnInfoPtr screen_info, unsigned long *frame_usec)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    xf86CrtcPtr crtc, best = NULL;
+    unsigned long usec;
+    int i;
+
+    for (i = 0; i < config->num_crtc; i++) {
+        crtc = config->crtc[i];
+        if (!crtc->enabled || crtc->mode.Clock <= 0)
+            continue;
+        usec = (unsigned long)crtc->mode.HTotal * crtc->mode.VTotal * 1000 /
+               crtc->mode.Clock;
+        if (best == NULL || usec < *frame_usec) {
+            best = crtc;
+            *frame_usec = usec;
+        }
+    }
+    return best;
+}
+
+/*
+ * Copy a region to VRAM.  Large ones are copied in bands by the pool,
+ * the rest right here; either way every band is in VRAM on return.
+ */
+static void
+avivo_shadow_flush(ScrnInfoPtr screen_info, RegionPtr region)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+    struct avivo_blit_job job;
+    unsigned long start, elapsed, bytes, frame_usec;
+    xf86CrtcPtr crtc;
+    int banded, nbox;
+
+    job.nbox = REGION_NUM_RECTS(region);
+    if (!job.nbox)
+        return;
+    start = avivo_get_usec();
+    job.blit = shadow->blit;
+    job.dst = (unsigned char *)avivo->fb_base + screen_info->fbOffset;
+    job.src = avivo->fb_shadow;
+    job.pitch = screen_info->displayWidth * avivo->bpp;
+    job.cpp = avivo->bpp;
+    job.boxes = (const short *)REGION_RECTS(region);
+    if (shadow->tile_check) {
+        nbox = avivo_shadow_tiles_filter(screen_info, REGION_RECTS(region),
+                                         job.nbox);
+        /* out of memory, copy everything and start over */
+        if (nbox < 0)
+            avivo_shadow_tiles_invalidate(screen_info);
+        else {
+            job.nbox = nbox;
+            job.boxes = (const short *)shadow->tiles.boxes;
+        }
+    }
+    bytes = avivo_blit_run(&shadow->pool, &job, &banded);
+
+    shadow->flush_usec = avivo_get_usec();
+    elapsed = shadow->flush_usec - start;
+    shadow->flushes++;
+    shadow->boxes += job.nbox;
+    shadow->bytes += bytes;
+    shadow->total_usec += elapsed;
+    if (elapsed > shadow->max_usec)
+        shadow->max_usec = elapsed;
+    if (banded) {
+        shadow->banded++;
+        shadow->banded_bytes += bytes;
+        shadow->banded_usec += elapsed;
+    }
+    if (shadow->coalesce && screen_info->vtSema) {
+        crtc = avivo_shadow_pace_crtc(screen_info, &frame_usec);
+        if (crtc)
+            shadow->flush_frame = avivo_crtc_frame_count(crtc);
+    }
+}
+
+/*
+ * How long the pending damage may still wait, in usec, 0 if it is due.
+ * At most one flush per frame of the fastest crtc: right after its
+ * next vblank if the chip tells where it is, a frame after the last
+ * flush otherwise.  Nothing waits longer than max_latency_usec.
+ */
+static unsigned long
+avivo_shadow_delay(ScrnInfoPtr screen_info, Bool *forced)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+    unsigned long now, waited, frame_usec, vblank_usec, delay;
+    xf86CrtcPtr crtc;
+    CARD32 frame;
+
+    *forced = FALSE;
+    now = avivo_get_usec();
+    waited = now - shadow->pending_usec;
+    if (waited >= shadow->max_latency_usec) {
+        *forced = TRUE;
+        return 0;
+    }
+    crtc = avivo_shadow_pace_crtc(screen_info, &frame_usec);
+    if (crtc == NULL || !screen_info->vtSema)
+        return 0;
+    if (avivo_crtc_vblank_time(crtc, &frame, &vblank_usec)) {
+        if (frame != shadow->flush_frame ||
+            vblank_usec + frame_usec <= now)
+            return 0;
+        delay = vblank_usec + frame_usec - now;
+    } else {
+        if (now - shadow->flush_usec >= frame_usec)
+            return 0;
+        delay = frame_usec - (now - shadow->flush_usec);
+    }
+    if (delay > shadow->max_latency_usec - waited)
+        delay = shadow->max_latency_usec - waited;
+    return delay;
+}
+
+/*
+ * ShadowUpdateProc: the shadow layer empties the damage afterwards.
+ * When coalescing, it is only added to what is pending and
+ * avivo_shadow_block_handler(), which runs right after, decides when
+ * it goes out.
+ */
+void
+avivo_shadow_update(ScreenPtr screen, shadowBufPtr buf)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+    RegionPtr damage = shadowDamage(buf);
+
+    if (!shadow->coalesce) {
+        avivo_shadow_flush(screen_info, damage);
+        return;
+    }
+    if (!REGION_NOTEMPTY(screen, damage))
+        return;
+    if (!REGION_NOTEMPTY(screen, &shadow->pending))
+        shadow->pending_usec = avivo_get_usec();
+    REGION_UNION(screen, &shadow->pending, &shadow->pending, damage);
+    shadow->updates++;
+}
+
+void
+avivo_shadow_flush_pending(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+
+    if (!shadow->coalesce ||
+        !REGION_NOTEMPTY(screen_info->pScreen, &shadow->pending))
+        return;
+    avivo_shadow_flush(screen_info, &shadow->pending);
+    REGION_EMPTY(screen_info->pScreen, &shadow->pending);
+}
+
+/*
+ * Registered after the shadow layer's own handlers, see
+ * avivo_shadow_register(), so it sees the damage the shadow layer just
+ * handed to avivo_shadow_update(): flush what is due, or make sure
+ * select() wakes us up in time to.  Screen BlockHandlers run before
+ * the registered ones and would miss the last update of a burst.
+ */
+static void
+avivo_shadow_block_handler(pointer data, OSTimePtr timeout, pointer read_mask)
+{
+    ScreenPtr screen = data;
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+    unsigned long delay;
+    Bool forced;
+
+    if (!REGION_NOTEMPTY(screen, &shadow->pending))
+        return;
+    delay = avivo_shadow_delay(screen_info, &forced);
+    if (delay) {
+        AdjustWaitForDelay(timeout, (delay + 999) / 1000);
+        return;
+    }
+    if (forced)
+        shadow->forced++;
+    avivo_shadow_flush_pending(screen_info);
+}
+
+static void
+avivo_shadow_wakeup_handler(pointer data, int result, pointer read_mask)
+{
+}
+
+/* Call once shadowAdd() has registered the shadow layer's handlers. */
+Bool
+avivo_shadow_register(ScreenPtr screen)
+{
+    ScrnInfoPtr screen_info = xf86Screens[screen->myNum];
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+
+    if (!shadow->coalesce || shadow->registered)
+        return TRUE;
+    if (!RegisterBlockAndWakeupHandlers(avivo_shadow_block_handler,
+                                        avivo_shadow_wakeup_handler,
+                                        screen))
+        return FALSE;
+    shadow->registered = TRUE;
+    return TRUE;
+}
+
+void
+avivo_shadow_dump_stats(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_shadow *shadow = &avivo->shadow;
+
+    if (!shadow->flushes)
+        return;
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "shadow: %lu flushes, %lu boxes, %lu kB, %lu us avg, "
+               "%lu us max, %lu MB/s\n",
+               shadow->flushes, shadow->boxes, shadow->bytes / 1024,
+               shadow->total_usec / shadow->flushes, shadow->max_usec,
+               shadow->total_usec ? shadow->bytes / shadow->total_usec : 0);
+    if (shadow->coalesce)
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "shadow: %lu updates coalesced in %lu flushes, "
+                   "%lu forced by the latency cap\n",
+                   shadow->updates, shadow->flushes, shadow->forced);
+    if (shadow->tile_check)
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "shadow tiles: %lu checked, %lu unchanged, %lu kB not "
+                   "copied, %lu us hashing\n",
+                   shadow->tiles.tiles_checked, shadow->tiles.tiles_skipped,
+                   shadow->tiles.bytes_saved / 1024, shadow->tiles.hash_usec);
+    if (shadow->banded)
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "shadow: %lu flushes in %d bands, %lu us avg, %lu MB/s\n",
+                   shadow->banded, shadow->pool.threads,
+                   shadow->banded_usec / shadow->banded,
+                   shadow->banded_usec ?
+                   shadow->banded_bytes / shadow->banded_usec : 0);
+}
@@ -28,150 +28,447 @@
 #ifdef WITH_VGAHW
 #include "vgaHW.h"
 #endif
+#include <string.h>
+#include <unistd.h>
 
 #include "avivo.h"
 #include "radeon_reg.h"
 
-void
+/*
+ * Wait for the chip to go idle.  Most waits are over after a few reads,
+ * so spin for a bit before sleeping, then back off exponentially so a
+ * slow mode set doesn't burn a CPU.  Returns FALSE if the chip is still
+ * busy after the timeout (Option "IdleTimeout", in ms), the caller
+ * decides whether it can carry on.
+ */
+Bool
 avivo_wait_idle(struct avivo_info *avivo)
 {
-    int i = 1000;
-  
-    while (--i && INREG(0x6494) != 0x3fffffff);
+    struct avivo_idle *idle = &avivo->idle;
+    unsigned long start, elapsed, sleep;
+    Bool ready;
+    int i;
+
+    idle->waits++;
+    for (i = 0; i < AVIVO_IDLE_SPINS; i++) {
+        if (INREG(0x6494) == 0x3fffffff)
+            return TRUE;
+    }
 
-    if (!i)
-        FatalError("Avivo: chip lockup!\n");
+    start = avivo_get_usec();
+    sleep = AVIVO_IDLE_MIN_SLEEP;
+    for (;;) {
+        elapsed = avivo_get_usec() - start;
+        ready = INREG(0x6494) == 0x3fffffff;
+        if (ready)
+            break;
+        if (elapsed >= idle->timeout_usec) {
+            idle->timeouts++;
+            xf86DrvMsg(avivo->scrn_index, X_ERROR,
+                       "chip still busy after %lu us (0x6494 = 0x%08x)\n",
+                       elapsed, INREG(0x6494));
+            break;
+        }
+        usleep(sleep);
+        idle->sleeps++;
+        if (sleep < AVIVO_IDLE_MAX_SLEEP)
+            sleep *= 2;
+    }
+
+    idle->total_usec += elapsed;
+    if (elapsed > idle->max_usec)
+        idle->max_usec = elapsed;
+    return ready;
+}
+
+void
+avivo_idle_dump_stats(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    struct avivo_idle *idle = &avivo->idle;
+
+    xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+               "idle wait: %lu waits, %lu sleeps, %lu timeouts, "
+               "%lu us total, %lu us max\n",
+               idle->waits, idle->sleeps, idle->timeouts,
+               idle->total_usec, idle->max_usec);
+}
+
+/*
+ * Everything we save when taking over the chip and put back when giving
+ * it up.  The table is in restore order; save reads it in the same
+ * order.  Registers flagged SAVE_ONLY are kept for reference (and for
+ * avivo_state_dump) but never written back.
+ */
+#define MMIO(reg, block, flags) { reg, AVIVO_STATE_MMIO, block, flags, #reg }
+#define MC(reg, block, flags)   { reg, AVIVO_STATE_MC, block, flags, #reg }
+
+static const struct avivo_state_reg avivo_state_regs[] = {
+    MC(AVIVO_MC_MEMORY_MAP,                 AVIVO_STATE_BLOCK_MC, 0),
+    MMIO(AVIVO_VGA_MEMORY_BASE,             AVIVO_STATE_BLOCK_VGA, 0),
+    MMIO(AVIVO_VGA_FB_START,                AVIVO_STATE_BLOCK_VGA, 0),
+    MMIO(AVIVO_VGA1_CONTROL,                AVIVO_STATE_BLOCK_VGA, 0),
+    MMIO(AVIVO_VGA2_CONTROL,                AVIVO_STATE_BLOCK_VGA, 0),
+
+    MMIO(AVIVO_PLL1_POST_DIV_CNTL,          AVIVO_STATE_BLOCK_PLL1, 0),
+    MMIO(AVIVO_PLL1_POST_DIV,               AVIVO_STATE_BLOCK_PLL1,
+         AVIVO_STATE_PLL_DIVIDER),
+    MMIO(AVIVO_PLL1_POST_DIV_MYSTERY,       AVIVO_STATE_BLOCK_PLL1, 0),
+    MMIO(AVIVO_PLL1_POST_MUL,               AVIVO_STATE_BLOCK_PLL1,
+         AVIVO_STATE_PLL_DIVIDER),
+    MMIO(AVIVO_PLL1_DIVIDER_CNTL,           AVIVO_STATE_BLOCK_PLL1, 0),
+    MMIO(AVIVO_PLL1_DIVIDER,                AVIVO_STATE_BLOCK_PLL1,
+         AVIVO_STATE_PLL_DIVIDER),
+    MMIO(AVIVO_PLL1_MYSTERY0,               AVIVO_STATE_BLOCK_PLL1, 0),
+    MMIO(AVIVO_PLL1_MYSTERY1,               AVIVO_STATE_BLOCK_PLL1, 0),
+    MMIO(AVIVO_PLL2_POST_DIV_CNTL,          AVIVO_STATE_BLOCK_PLL2, 0),
+    MMIO(AVIVO_PLL2_POST_DIV,               AVIVO_STATE_BLOCK_PLL2,
+         AVIVO_STATE_PLL_DIVIDER),
+    MMIO(AVIVO_PLL2_POST_DIV_MYSTERY,       AVIVO_STATE_BLOCK_PLL2, 0),
+    MMIO(AVIVO_PLL2_POST_MUL,               AVIVO_STATE_BLOCK_PLL2,
+         AVIVO_STATE_PLL_DIVIDER),
+    MMIO(AVIVO_PLL2_DIVIDER_CNTL,           AVIVO_STATE_BLOCK_PLL2, 0),
+    MMIO(AVIVO_PLL2_DIVIDER,                AVIVO_STATE_BLOCK_PLL2,
+         AVIVO_STATE_PLL_DIVIDER),
+    MMIO(AVIVO_PLL2_MYSTERY0,               AVIVO_STATE_BLOCK_PLL2, 0),
+    MMIO(AVIVO_PLL2_MYSTERY1,               AVIVO_STATE_BLOCK_PLL2, 0),
+    MMIO(AVIVO_CRTC_PLL_SOURCE,             AVIVO_STATE_BLOCK_PLL2, 0),
+
+    MMIO(AVIVO_CRTC1_H_TOTAL,               AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_H_BLANK,               AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_H_SYNC_WID,            AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_H_SYNC_POL,            AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_V_TOTAL,               AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_V_BLANK,               AVIVO_STATE_BLOCK_CRTC1, 0),
+    /*
+     * Weird we shouldn't restore sync width when going back to text
+     * mode, it must not be a 0 value, i guess a deeper look in cold
+     * text mode register value would help to understand what is
+     * truely needed to do.
+     */
+    MMIO(AVIVO_CRTC1_V_SYNC_WID,            AVIVO_STATE_BLOCK_CRTC1,
+         AVIVO_STATE_SAVE_ONLY),
+    MMIO(AVIVO_CRTC1_V_SYNC_POL,            AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_CNTL,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_BLANK_STATUS,          AVIVO_STATE_BLOCK_CRTC1,
+         AVIVO_STATE_SAVE_ONLY),
+    MMIO(AVIVO_CRTC1_STEREO_STATUS,         AVIVO_STATE_BLOCK_CRTC1,
+         AVIVO_STATE_SAVE_ONLY),
+    MMIO(AVIVO_CRTC1_SCAN_ENABLE,           AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_FB_FORMAT,             AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_FB_LOCATION,           AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_FB_END,                AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_PITCH,                 AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_X_LENGTH,              AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_Y_LENGTH,              AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_FB_HEIGHT,             AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_OFFSET_START,          AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_OFFSET_END,            AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_EXPANSION_SOURCE,      AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_EXPANSION_CNTL,        AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_DC_LB_MEMORY_SPLIT,          AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_PRIORITY_A_CNT,        AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_PRIORITY_B_CNT,        AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_6594,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_659C,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_65A4,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_65A8,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_65AC,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_65B0,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_65B8,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_65BC,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_65C0,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+    MMIO(AVIVO_CRTC1_65C8,                  AVIVO_STATE_BLOCK_CRTC1, 0),
+
+    MMIO(AVIVO_CRTC2_H_TOTAL,               AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_H_BLANK,               AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_H_SYNC_WID,            AVIVO_STATE_BLOCK_CRTC2,
+         AVIVO_STATE_SAVE_ONLY),
+    MMIO(AVIVO_CRTC2_H_SYNC_POL,            AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_V_TOTAL,               AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_V_BLANK,               AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_V_SYNC_WID,            AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_V_SYNC_POL,            AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_CNTL,                  AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_BLANK_STATUS,          AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_SCAN_ENABLE,           AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_FB_FORMAT,             AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_FB_LOCATION,           AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_FB_END,                AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_PITCH,                 AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_X_LENGTH,              AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_Y_LENGTH,              AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_PRIORITY_A_CNT,        AVIVO_STATE_BLOCK_CRTC2, 0),
+    MMIO(AVIVO_CRTC2_PRIORITY_B_CNT,        AVIVO_STATE_BLOCK_CRTC2, 0),
+
+    MMIO(AVIVO_DACA_CNTL,                   AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_DACA_FORCE_OUTPUT_CNTL,      AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_DACA_POWERDOWN,              AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_TMDSA_CNTL,                  AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_TMDSA_BIT_DEPTH_CONTROL,     AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_TMDSA_DATA_SYNCHRONIZATION,  AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_TMDSA_TRANSMITTER_ENABLE,    AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_TMDSA_TRANSMITTER_CONTROL,   AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_DACB_CNTL,                   AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_DACB_FORCE_OUTPUT_CNTL,      AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_DACB_POWERDOWN,              AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_LVTMA_CNTL,                  AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_LVTMA_BIT_DEPTH_CONTROL,     AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_LVTMA_DATA_SYNCHRONIZATION,  AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_LVTMA_TRANSMITTER_ENABLE,    AVIVO_STATE_BLOCK_OUTPUT, 0),
+    MMIO(AVIVO_LVTMA_TRANSMITTER_CONTROL,   AVIVO_STATE_BLOCK_OUTPUT, 0),
+
+    /* restored after the VGA state, through the register shadow */
+    MMIO(AVIVO_CURSOR1_CNTL,                AVIVO_STATE_BLOCK_CURSOR,
+         AVIVO_STATE_SHADOW),
+    MMIO(AVIVO_CURSOR1_LOCATION,            AVIVO_STATE_BLOCK_CURSOR, 0),
+    MMIO(AVIVO_CURSOR1_SIZE,                AVIVO_STATE_BLOCK_CURSOR, 0),
+    MMIO(AVIVO_CURSOR1_POSITION,            AVIVO_STATE_BLOCK_CURSOR,
+         AVIVO_STATE_SHADOW),
+};
+
+#undef MMIO
+#undef MC
+
+#define AVIVO_STATE_NUM_REGS \
+    (sizeof(avivo_state_regs) / sizeof(avivo_state_regs[0]))
+
+/* struct avivo_state must have room for the whole table */
+typedef char avivo_state_size_check[
+    AVIVO_STATE_NUM_REGS <= AVIVO_STATE_MAX_REGS ? 1 : -1];
+
+static void
+avivo_state_save_reg(ScrnInfoPtr screen_info, struct avivo_state *state,
+                     int i)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    const struct avivo_state_reg *reg = &avivo_state_regs[i];
+
+    if (reg->access == AVIVO_STATE_MC)
+        state->value[i] = avivo_get_mc(screen_info, reg->offset);
+    else
+        state->value[i] = INREG(reg->offset);
+}
+
+static void
+avivo_state_restore_reg(ScrnInfoPtr screen_info, struct avivo_state *state,
+                        int i)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    const struct avivo_state_reg *reg = &avivo_state_regs[i];
+
+    if (reg->flags & AVIVO_STATE_SAVE_ONLY)
+        return;
+    if (reg->access == AVIVO_STATE_MC)
+        avivo_set_mc(screen_info, reg->offset, state->value[i]);
+    else if (reg->flags & AVIVO_STATE_SHADOW)
+        avivo_reg_write(avivo, reg->offset, state->value[i]);
+    else
+        OUTREG(reg->offset, state->value[i]);
+}
+
+/* Save or restore every register of one block. */
+static void
+avivo_state_block(ScrnInfoPtr screen_info, struct avivo_state *state,
+                  enum avivo_state_block block, Bool restore)
+{
+    int i;
+
+    for (i = 0; i < AVIVO_STATE_NUM_REGS; i++) {
+        if (avivo_state_regs[i].block != block)
+            continue;
+        if (restore)
+            avivo_state_restore_reg(screen_info, state, i);
+        else
+            avivo_state_save_reg(screen_info, state, i);
+    }
+}
+
+int
+avivo_state_num_regs(void)
+{
+    return AVIVO_STATE_NUM_REGS;
+}
+
+const struct avivo_state_reg *
+avivo_state_get_reg(int i)
+{
+    if (i < 0 || i >= AVIVO_STATE_NUM_REGS)
+        return NULL;
+    return &avivo_state_regs[i];
+}
+
+/*
+ * Registers that tell us whether the console touched the chip while we
+ * were switched away: memory mapping, VGA control, PLLs, the crtc
+ * setup and where it pans to.  Hashed with FNV-1a.  The VGA font is
+ * in memory, not registers; avivo_save_fonts() takes it again.
+ */
+static const unsigned int avivo_fingerprint_regs[] = {
+    AVIVO_VGA_MEMORY_BASE,
+    AVIVO_VGA_FB_START,
+    AVIVO_VGA1_CONTROL,
+    AVIVO_VGA2_CONTROL,
+    AVIVO_PLL1_POST_DIV,
+    AVIVO_PLL1_POST_MUL,
+    AVIVO_PLL1_DIVIDER,
+    AVIVO_PLL2_POST_DIV,
+    AVIVO_PLL2_POST_MUL,
+    AVIVO_PLL2_DIVIDER,
+    AVIVO_CRTC_PLL_SOURCE,
+    AVIVO_CRTC1_CNTL,
+    AVIVO_CRTC1_H_TOTAL,
+    AVIVO_CRTC1_V_TOTAL,
+    AVIVO_CRTC1_FB_FORMAT,
+    AVIVO_CRTC1_FB_LOCATION,
+    AVIVO_CRTC1_PITCH,
+    AVIVO_CRTC1_OFFSET_START,
+    AVIVO_CRTC2_CNTL,
+    AVIVO_CRTC2_H_TOTAL,
+    AVIVO_CRTC2_V_TOTAL,
+    AVIVO_CRTC2_FB_FORMAT,
+    AVIVO_CRTC2_FB_LOCATION,
+    AVIVO_CRTC2_PITCH,
+    AVIVO_CRTC2_OFFSET_START,
+    AVIVO_DACA_CNTL,
+    AVIVO_DACB_CNTL,
+    AVIVO_TMDSA_CNTL,
+    AVIVO_LVTMA_CNTL,
+};
+
+static CARD32
+avivo_fnv(CARD32 hash, CARD32 value)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+CARD32
+avivo_state_fingerprint(ScrnInfoPtr screen_info)
+{
+    struct avivo_info *avivo = avivo_get_info(screen_info);
+    CARD32 hash = 2166136261U;
+    int i;
+
+    hash = avivo_fnv(hash, avivo_get_mc(screen_info, AVIVO_MC_MEMORY_MAP));
+    for (i = 0; i < sizeof(avivo_fingerprint_regs) /
+                    sizeof(avivo_fingerprint_regs[0]); i++)
+        hash = avivo_fnv(hash, INREG(avivo_fingerprint_regs[i]));
+#ifdef WITH_VGAHW
+    {
+        vgaHWPtr hwp = VGAHWPTR(screen_info);
+
+        /* text start address (scrollback), font select, pel panning */
+        hash = avivo_fnv(hash, hwp->readCrtc(hwp, 0x0c));
+        hash = avivo_fnv(hash, hwp->readCrtc(hwp, 0x0d));
+        hash = avivo_fnv(hash, hwp->readSeq(hwp, 0x03));
+        hash = avivo_fnv(hash, hwp->readAttr(hwp, 0x13));
+    }
+#endif
+    return hash;
+}
+
+/*
+ * Fill changed with the index of every register that differs between a
+ * and b, returns how many there are.  changed needs room for
+ * avivo_state_num_regs() entries.
+ */
+int
+avivo_state_diff(const struct avivo_state *a, const struct avivo_state *b,
+                 int *changed)
+{
+    int i, count = 0;
+
+    for (i = 0; i < AVIVO_STATE_NUM_REGS; i++) {
+        if (a->value[i] != b->value[i])
+            changed[count++] = i;
+    }
+    return count;
+}
+
+/*
+ * Log a state as "offset<tab>value" lines, the same format as
+ * "avivotool regs all", so it can be fed to avivotool --sim.  MC
+ * registers are prefixed with MC: instead.
+ */
+void
+avivo_state_dump(ScrnInfoPtr screen_info, const struct avivo_state *state,
+                 int verb)
+{
+    const struct avivo_state_reg *reg;
+    int i;
+
+    for (i = 0; i < AVIVO_STATE_NUM_REGS; i++) {
+        reg = &avivo_state_regs[i];
+        xf86DrvMsgVerb(screen_info->scrnIndex, X_INFO, verb,
+                       "%s%08x\t%08x\t%s\n",
+                       reg->access == AVIVO_STATE_MC ? "MC:" : "",
+                       reg->offset, (unsigned int)state->value[i],
+                       reg->name);
+    }
 }
 
 void
 avivo_save_cursor(ScrnInfoPtr screen_info)
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
-    struct avivo_state *state = &avivo->saved_state;
 
-    state->cursor1_cntl = INREG(AVIVO_CURSOR1_CNTL);
-    state->cursor1_location = INREG(AVIVO_CURSOR1_LOCATION);
-    state->cursor1_size = INREG(AVIVO_CURSOR1_SIZE);
-    state->cursor1_position = INREG(AVIVO_CURSOR1_POSITION);
+    avivo_state_block(screen_info, &avivo->saved_state,
+                      AVIVO_STATE_BLOCK_CURSOR, FALSE);
 }
 
 void
 avivo_restore_cursor(ScrnInfoPtr screen_info)
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
-    struct avivo_state *state = &avivo->saved_state;
 
-    OUTREG(AVIVO_CURSOR1_CNTL, state->cursor1_cntl);
-    OUTREG(AVIVO_CURSOR1_LOCATION, state->cursor1_location);
-    OUTREG(AVIVO_CURSOR1_SIZE, state->cursor1_size);
-    OUTREG(AVIVO_CURSOR1_POSITION, state->cursor1_position);
+    avivo_state_block(screen_info, &avivo->saved_state,
+                      AVIVO_STATE_BLOCK_CURSOR, TRUE);
 }
 
-void
+/*
+ * Put the saved state back, writing only the registers that don't
+ * already hold the saved value.  A PLL is reprogrammed as a whole, in
+ * table order, only when one of its dividers changed; otherwise its
+ * registers are treated like any other.  Returns the number of
+ * registers written.
+ */
+int
 avivo_restore_state(ScrnInfoPtr screen_info)
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
     struct avivo_state *state = &avivo->saved_state;
+    struct avivo_state current;
+    const struct avivo_state_reg *reg;
+    Bool pll_changed[AVIVO_STATE_BLOCK_CURSOR + 1];
+    int i, written = 0;
 
-    avivo_set_mc(screen_info, AVIVO_MC_MEMORY_MAP, state->mc_memory_map);
-    OUTREG(AVIVO_VGA_MEMORY_BASE, state->vga_memory_base);
-    OUTREG(AVIVO_VGA_FB_START, state->vga_fb_start);
-    OUTREG(AVIVO_VGA1_CONTROL, state->vga_mystery0);
-    OUTREG(AVIVO_VGA2_CONTROL, state->vga_mystery1);
-
-    OUTREG(AVIVO_PLL1_POST_DIV_CNTL, state->pll1_post_div_cntl);
-    OUTREG(AVIVO_PLL1_POST_DIV, state->pll1_post_div);
-    OUTREG(AVIVO_PLL1_POST_DIV_MYSTERY, state->pll1_post_div_mystery);
-    OUTREG(AVIVO_PLL1_POST_MUL, state->pll1_post_mul);
-    OUTREG(AVIVO_PLL1_DIVIDER_CNTL, state->pll1_divider_cntl);
-    OUTREG(AVIVO_PLL1_DIVIDER, state->pll1_divider);
-    OUTREG(AVIVO_PLL1_MYSTERY0, state->pll1_mystery0);
-    OUTREG(AVIVO_PLL1_MYSTERY1, state->pll1_mystery1);
-    OUTREG(AVIVO_PLL2_POST_DIV_CNTL, state->pll2_post_div_cntl);
-    OUTREG(AVIVO_PLL2_POST_DIV, state->pll2_post_div);
-    OUTREG(AVIVO_PLL2_POST_DIV_MYSTERY, state->pll2_post_div_mystery);
-    OUTREG(AVIVO_PLL2_POST_MUL, state->pll2_post_mul);
-    OUTREG(AVIVO_PLL2_DIVIDER_CNTL, state->pll2_divider_cntl);
-    OUTREG(AVIVO_PLL2_DIVIDER, state->pll2_divider);
-    OUTREG(AVIVO_PLL2_MYSTERY0, state->pll2_mystery0);
-    OUTREG(AVIVO_PLL2_MYSTERY1, state->pll2_mystery1);
-    OUTREG(AVIVO_CRTC_PLL_SOURCE, state->crtc_pll_source);
-
-    OUTREG(AVIVO_CRTC1_H_TOTAL, state->crtc1_h_total);
-    OUTREG(AVIVO_CRTC1_H_BLANK, state->crtc1_h_blank);
-    OUTREG(AVIVO_CRTC1_H_SYNC_WID, state->crtc1_h_sync_wid);
-    OUTREG(AVIVO_CRTC1_H_SYNC_POL, state->crtc1_h_sync_pol);
-    OUTREG(AVIVO_CRTC1_V_TOTAL, state->crtc1_v_total);
-    OUTREG(AVIVO_CRTC1_V_BLANK, state->crtc1_v_blank);
-    /*
-     * Weird we shouldn't restore sync width when going back to text
-     * mode, it must not be a 0 value, i guess a deeper look in cold
-     * text mode register value would help to understand what is
-     * truely needed to do.
-     */
-#if 0
-    OUTREG(AVIVO_CRTC1_V_SYNC_WID, state->crtc1_v_sync_wid);
-#endif
-    OUTREG(AVIVO_CRTC1_V_SYNC_POL, state->crtc1_v_sync_pol);
-    OUTREG(AVIVO_CRTC1_CNTL, state->crtc1_cntl);
-    OUTREG(AVIVO_CRTC1_SCAN_ENABLE, state->crtc1_scan_enable);
-    OUTREG(AVIVO_CRTC1_FB_FORMAT, state->crtc1_fb_format);
-    OUTREG(AVIVO_CRTC1_FB_LOCATION, state->crtc1_fb_location);
-    OUTREG(AVIVO_CRTC1_FB_END, state->crtc1_fb_end);
-    OUTREG(AVIVO_CRTC1_PITCH, state->crtc1_pitch);
-    OUTREG(AVIVO_CRTC1_X_LENGTH, state->crtc1_x_length);
-    OUTREG(AVIVO_CRTC1_Y_LENGTH, state->crtc1_y_length);
-    OUTREG(AVIVO_CRTC1_FB_HEIGHT, state->crtc1_fb_height);
-    OUTREG(AVIVO_CRTC1_OFFSET_START, state->crtc1_offset_start);
-    OUTREG(AVIVO_CRTC1_OFFSET_END, state->crtc1_offset_end);
-    OUTREG(AVIVO_CRTC1_EXPANSION_SOURCE, state->crtc1_expn_size);
-    OUTREG(AVIVO_CRTC1_EXPANSION_CNTL, state->crtc1_expn_cntl);
-    OUTREG(AVIVO_CRTC1_6594, state->crtc1_6594);
-    OUTREG(AVIVO_CRTC1_659C, state->crtc1_659c);
-    OUTREG(AVIVO_CRTC1_65A4, state->crtc1_65a4);
-    OUTREG(AVIVO_CRTC1_65A8, state->crtc1_65a8);
-    OUTREG(AVIVO_CRTC1_65AC, state->crtc1_65ac);
-    OUTREG(AVIVO_CRTC1_65B0, state->crtc1_65b0);
-    OUTREG(AVIVO_CRTC1_65B8, state->crtc1_65b8);
-    OUTREG(AVIVO_CRTC1_65BC, state->crtc1_65bc);
-    OUTREG(AVIVO_CRTC1_65C0, state->crtc1_65c0);
-    OUTREG(AVIVO_CRTC1_65C8, state->crtc1_65c8);
-    OUTREG(AVIVO_CRTC2_H_TOTAL, state->crtc2_h_total);
-    OUTREG(AVIVO_CRTC2_H_BLANK, state->crtc2_h_blank);
-#if 0
-    OUTREG(AVIVO_CRTC2_H_SYNC_WID, state->crtc2_h_sync_wid);
-#endif
-    OUTREG(AVIVO_CRTC2_H_SYNC_POL, state->crtc2_h_sync_pol);
-    OUTREG(AVIVO_CRTC2_V_TOTAL, state->crtc2_v_total);
-    OUTREG(AVIVO_CRTC2_V_BLANK, state->crtc2_v_blank);
-    OUTREG(AVIVO_CRTC2_V_SYNC_WID, state->crtc2_v_sync_wid);
-    OUTREG(AVIVO_CRTC2_V_SYNC_POL, state->crtc2_v_sync_pol);
-    OUTREG(AVIVO_CRTC2_CNTL, state->crtc2_cntl);
-    OUTREG(AVIVO_CRTC2_BLANK_STATUS, state->crtc2_blank_status);
-    OUTREG(AVIVO_CRTC2_SCAN_ENABLE, state->crtc2_scan_enable);
-    OUTREG(AVIVO_CRTC2_FB_FORMAT, state->crtc2_fb_format);
-    OUTREG(AVIVO_CRTC2_FB_LOCATION, state->crtc2_fb_location);
-    OUTREG(AVIVO_CRTC2_FB_END, state->crtc2_fb_end);
-    OUTREG(AVIVO_CRTC2_PITCH, state->crtc2_pitch);
-    OUTREG(AVIVO_CRTC2_X_LENGTH, state->crtc2_x_length);
-    OUTREG(AVIVO_CRTC2_Y_LENGTH, state->crtc2_y_length);
-
-    OUTREG(AVIVO_DACA_CNTL, state->dac1_cntl);
-    OUTREG(AVIVO_DACA_FORCE_OUTPUT_CNTL, state->dac1_mystery1);
-    OUTREG(AVIVO_DACA_POWERDOWN, state->dac1_mystery2);
-    OUTREG(AVIVO_TMDSA_CNTL, state->tmds1_cntl);
-    OUTREG(AVIVO_TMDSA_BIT_DEPTH_CONTROL, state->tmds1_mystery1);
-    OUTREG(AVIVO_TMDSA_DATA_SYNCHRONIZATION, state->tmds1_mystery2);
-    OUTREG(AVIVO_TMDSA_TRANSMITTER_ENABLE, state->tmds1_clock_cntl);
-    OUTREG(AVIVO_TMDSA_TRANSMITTER_CONTROL, state->tmds1_mystery3);
-    OUTREG(AVIVO_DACB_CNTL, state->dac2_cntl);
-    OUTREG(AVIVO_DACB_FORCE_OUTPUT_CNTL, state->dac2_mystery1);
-    OUTREG(AVIVO_DACB_POWERDOWN, state->dac2_mystery2);
-    OUTREG(AVIVO_LVTMA_CNTL, state->tmds2_cntl);
-    OUTREG(AVIVO_LVTMA_BIT_DEPTH_CONTROL, state->tmds2_mystery1);
-    OUTREG(AVIVO_LVTMA_DATA_SYNCHRONIZATION, state->tmds2_mystery2);
-    OUTREG(AVIVO_LVTMA_TRANSMITTER_ENABLE, state->tmds2_clock_cntl);
-    OUTREG(AVIVO_LVTMA_TRANSMITTER_CONTROL, state->tmds2_mystery3);
+    memset(pll_changed, 0, sizeof(pll_changed));
+    for (i = 0; i < AVIVO_STATE_NUM_REGS; i++) {
+        reg = &avivo_state_regs[i];
+        if (reg->flags & AVIVO_STATE_SAVE_ONLY)
+            continue;
+        avivo_state_save_reg(screen_info, &current, i);
+        if ((reg->flags & AVIVO_STATE_PLL_DIVIDER) &&
+            current.value[i] != state->value[i])
+            pll_changed[reg->block] = TRUE;
+    }
+
+    for (i = 0; i < AVIVO_STATE_NUM_REGS; i++) {
+        reg = &avivo_state_regs[i];
+        if (reg->block == AVIVO_STATE_BLOCK_CURSOR ||
+            (reg->flags & AVIVO_STATE_SAVE_ONLY))
+            continue;
+        if (!pll_changed[reg->block] && current.value[i] == state->value[i])
+            continue;
+        avivo_state_restore_reg(screen_info, state, i);
+        written++;
+    }
 #ifdef WITH_VGAHW
     vgaHWPtr hwp = VGAHWPTR(screen_info);
     vgaHWUnlock(hwp);
@@ -180,13 +477,15 @@ avivo_restore_state(ScrnInfoPtr screen_info)
 #endif
 
     avivo_restore_cursor(screen_info);
-}    
+    return written;
+}
 
 void
 avivo_save_state(ScrnInfoPtr screen_info)
 {
     struct avivo_info *avivo = avivo_get_info(screen_info);
     struct avivo_state *state = &avivo->saved_state;    
+    int i;
 
 #ifdef WITH_VGAHW
     vgaHWPtr hwp = VGAHWPTR(screen_info);
@@ -195,101 +494,27 @@ avivo_save_state(ScrnInfoPtr screen_info)
     vgaHWLock(hwp);
 #endif
 
+    /* whoever had the hardware before us may have changed anything */
+    avivo_reg_shadow_invalidate(avivo);
     avivo_save_cursor(screen_info);
 
-    state->mc_memory_map = avivo_get_mc(screen_info, AVIVO_MC_MEMORY_MAP);
-    state->vga_memory_base = INREG(AVIVO_VGA_MEMORY_BASE);
-    state->vga_fb_start = INREG(AVIVO_VGA_FB_START);
-    state->vga_mystery0 = INREG(AVIVO_VGA1_CONTROL);
-    state->vga_mystery1 = INREG(AVIVO_VGA2_CONTROL);
-
-    state->pll1_post_div_cntl = INREG(AVIVO_PLL1_POST_DIV_CNTL);
-    state->pll1_post_div = INREG(AVIVO_PLL1_POST_DIV);
-    state->pll1_post_div_mystery = INREG(AVIVO_PLL1_POST_DIV_MYSTERY);
-    state->pll1_post_mul = INREG(AVIVO_PLL1_POST_MUL);
-    state->pll1_divider_cntl = INREG(AVIVO_PLL1_DIVIDER_CNTL);
-    state->pll1_divider = INREG(AVIVO_PLL1_DIVIDER);
-    state->pll1_mystery0 = INREG(AVIVO_PLL1_MYSTERY0);
-    state->pll1_mystery1 = INREG(AVIVO_PLL1_MYSTERY1);
-    state->pll2_post_div_cntl = INREG(AVIVO_PLL2_POST_DIV_CNTL);
-    state->pll2_post_div = INREG(AVIVO_PLL2_POST_DIV);
-    state->pll2_post_div_mystery = INREG(AVIVO_PLL2_POST_DIV_MYSTERY);
-    state->pll2_post_mul = INREG(AVIVO_PLL2_POST_MUL);
-    state->pll2_divider_cntl = INREG(AVIVO_PLL2_DIVIDER_CNTL);
-    state->pll2_divider = INREG(AVIVO_PLL2_DIVIDER);
-    state->pll2_mystery0 = INREG(AVIVO_PLL2_MYSTERY0);
-    state->pll2_mystery1 = INREG(AVIVO_PLL2_MYSTERY1);
-    state->crtc_pll_source = INREG(AVIVO_CRTC_PLL_SOURCE);
-
-    state->crtc1_h_total = INREG(AVIVO_CRTC1_H_TOTAL);
-    state->crtc1_h_blank = INREG(AVIVO_CRTC1_H_BLANK);
-    state->crtc1_h_sync_wid = INREG(AVIVO_CRTC1_H_SYNC_WID);
-    state->crtc1_h_sync_pol = INREG(AVIVO_CRTC1_H_SYNC_POL);
-    state->crtc1_v_total = INREG(AVIVO_CRTC1_V_TOTAL);
-    state->crtc1_v_blank = INREG(AVIVO_CRTC1_V_BLANK);
-    state->crtc1_v_sync_wid = INREG(AVIVO_CRTC1_V_SYNC_WID);
-    state->crtc1_v_sync_pol = INREG(AVIVO_CRTC1_V_SYNC_POL);
-    state->crtc1_cntl = INREG(AVIVO_CRTC1_CNTL);
-    state->crtc1_blank_status = INREG(AVIVO_CRTC1_BLANK_STATUS);
-    state->crtc1_stereo_status = INREG(AVIVO_CRTC1_STEREO_STATUS);
-    state->crtc1_scan_enable = INREG(AVIVO_CRTC1_SCAN_ENABLE);
-    state->crtc1_fb_format = INREG(AVIVO_CRTC1_FB_FORMAT);
-    state->crtc1_fb_location = INREG(AVIVO_CRTC1_FB_LOCATION);
-    state->crtc1_fb_end = INREG(AVIVO_CRTC1_FB_END);
-    state->crtc1_pitch = INREG(AVIVO_CRTC1_PITCH);
-    state->crtc1_x_length = INREG(AVIVO_CRTC1_X_LENGTH);
-    state->crtc1_y_length = INREG(AVIVO_CRTC1_Y_LENGTH);
-    state->crtc1_fb_height = INREG(AVIVO_CRTC1_FB_HEIGHT);
-    state->crtc1_offset_start = INREG(AVIVO_CRTC1_OFFSET_START);
-    state->crtc1_offset_end = INREG(AVIVO_CRTC1_OFFSET_END);
-    state->crtc1_expn_size = INREG(AVIVO_CRTC1_EXPANSION_SOURCE);
-    state->crtc1_expn_cntl = INREG(AVIVO_CRTC1_EXPANSION_CNTL);
-    state->crtc1_6594 = INREG(AVIVO_CRTC1_6594);
-    state->crtc1_659c = INREG(AVIVO_CRTC1_659C);
-    state->crtc1_65a4 = INREG(AVIVO_CRTC1_65A4);
-    state->crtc1_65a8 = INREG(AVIVO_CRTC1_65A8);
-    state->crtc1_65ac = INREG(AVIVO_CRTC1_65AC);
-    state->crtc1_65b0 = INREG(AVIVO_CRTC1_65B0);
-    state->crtc1_65b8 = INREG(AVIVO_CRTC1_65B8);
-    state->crtc1_65bc = INREG(AVIVO_CRTC1_65BC);
-    state->crtc1_65c0 = INREG(AVIVO_CRTC1_65C0);
-    state->crtc1_65c8 = INREG(AVIVO_CRTC1_65C8);
-
-    state->crtc2_h_total = INREG(AVIVO_CRTC2_H_TOTAL);
-    state->crtc2_h_blank = INREG(AVIVO_CRTC2_H_BLANK);
-    state->crtc2_h_sync_wid = INREG(AVIVO_CRTC2_H_SYNC_WID);
-    state->crtc2_h_sync_pol = INREG(AVIVO_CRTC2_H_SYNC_POL);
-    state->crtc2_v_total = INREG(AVIVO_CRTC2_V_TOTAL);
-    state->crtc2_v_blank = INREG(AVIVO_CRTC2_V_BLANK);
-    state->crtc2_v_sync_wid = INREG(AVIVO_CRTC2_V_SYNC_WID);
-    state->crtc2_v_sync_pol = INREG(AVIVO_CRTC2_V_SYNC_POL);
-    state->crtc2_cntl = INREG(AVIVO_CRTC2_CNTL);
-    state->crtc2_blank_status = INREG(AVIVO_CRTC2_BLANK_STATUS);
-    state->crtc2_scan_enable = INREG(AVIVO_CRTC2_SCAN_ENABLE);
-    state->crtc2_fb_format = INREG(AVIVO_CRTC2_FB_FORMAT);
-    state->crtc2_fb_location = INREG(AVIVO_CRTC2_FB_LOCATION);
-    state->crtc2_fb_end = INREG(AVIVO_CRTC2_FB_END);
-    state->crtc2_pitch = INREG(AVIVO_CRTC2_PITCH);
-    state->crtc2_x_length = INREG(AVIVO_CRTC2_X_LENGTH);
-    state->crtc2_y_length = INREG(AVIVO_CRTC2_Y_LENGTH);
-
-    state->dac1_cntl = INREG(AVIVO_DACA_CNTL);
-    state->dac1_mystery1 = INREG(AVIVO_DACA_FORCE_OUTPUT_CNTL);
-    state->dac1_mystery2 = INREG(AVIVO_DACA_POWERDOWN);
-
-    state->tmds1_cntl = INREG(AVIVO_TMDSA_CNTL);
-    state->tmds1_mystery1 = INREG(AVIVO_TMDSA_BIT_DEPTH_CONTROL);
-    state->tmds1_mystery2 = INREG(AVIVO_TMDSA_DATA_SYNCHRONIZATION);
-    state->tmds1_clock_cntl = INREG(AVIVO_TMDSA_TRANSMITTER_ENABLE);
-    state->tmds1_mystery3 = INREG(AVIVO_TMDSA_TRANSMITTER_CONTROL);
-
-    state->dac2_cntl = INREG(AVIVO_DACB_CNTL);
-    state->dac2_mystery1 = INREG(AVIVO_DACB_FORCE_OUTPUT_CNTL);
-    state->dac2_mystery2 = INREG(AVIVO_DACB_POWERDOWN);
-
-    state->tmds2_cntl = INREG(AVIVO_LVTMA_CNTL);
-    state->tmds2_mystery1 = INREG(AVIVO_LVTMA_BIT_DEPTH_CONTROL);
-    state->tmds2_mystery2 = INREG(AVIVO_LVTMA_DATA_SYNCHRONIZATION);
-    state->tmds2_clock_cntl = INREG(AVIVO_LVTMA_TRANSMITTER_ENABLE);
-    state->tmds2_mystery3 = INREG(AVIVO_LVTMA_TRANSMITTER_CONTROL);
+    for (i = 0; i < AVIVO_STATE_NUM_REGS; i++) {
+        if (avivo_state_regs[i].block != AVIVO_STATE_BLOCK_CURSOR)
+            avivo_state_save_reg(screen_info, state, i);
+    }
+}
+
+/*
+ * Take the console fonts again when the rest of the snapshot is reused:
+ * the fingerprint can't see a new font loaded with the same registers.
+ */
+void
+avivo_save_fonts(ScrnInfoPtr screen_info)
+{
+#ifdef WITH_VGAHW
+    vgaHWPtr hwp = VGAHWPTR(screen_info);
+    vgaHWUnlock(hwp);
+    vgaHWSave(screen_info, &hwp->SavedReg, VGA_SR_FONTS);
+    vgaHWLock(hwp);
+#endif
 }
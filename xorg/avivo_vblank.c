@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo vblank: frame counter, scanout position, and waiting for a
+ * given line.  No interrupts, everything is read from the crtc status
+ * registers and the mode timings.  Lines are numbered from the start
+ * of vsync: the active area is wherever V_BLANK puts it, see
+ * avivo_crtc_mode_set(), and the frame counter ticks as vblank starts.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <unistd.h>
+
+#include "avivo.h"
+#include "radeon_reg.h"
+
+/* wake up this early, in us, and spin the rest */
+#define AVIVO_VBLANK_SPIN_USEC  500
+
+/* how long one line takes, in ns; 0 if the crtc isn't scanning out */
+static unsigned long
+avivo_crtc_line_ns(xf86CrtcPtr crtc)
+{
+    DisplayModePtr mode = &crtc->mode;
+
+    if (!crtc->enabled || mode->Clock <= 0 || mode->VTotal <= 0)
+        return 0;
+    return (unsigned long)mode->HTotal * 1000000 / mode->Clock;
+}
+
+/* first line of vblank, and first active line, as programmed */
+static void
+avivo_crtc_vblank_lines(xf86CrtcPtr crtc, int *start, int *end)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+
+    *start = avivo_crtc->v_blank & 0xffff;
+    *end = (avivo_crtc->v_blank >> 16) & 0xffff;
+}
+
+CARD32
+avivo_crtc_frame_count(xf86CrtcPtr crtc)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+
+    return INREG(AVIVO_CRTC1_STATUS_FRAME_COUNT + avivo_crtc->crtc_offset);
+}
+
+/* Where the crtc is scanning; returns TRUE while in vblank. */
+Bool
+avivo_crtc_get_position(xf86CrtcPtr crtc, int *line, int *pixel)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_info *avivo = avivo_get_info(crtc->scrn);
+    CARD32 position;
+    int start, end;
+
+    position = INREG(AVIVO_CRTC1_STATUS_POSITION + avivo_crtc->crtc_offset);
+    *line = position & AVIVO_CRTC_V_POSITION_MASK;
+    *pixel = (position >> AVIVO_CRTC_H_POSITION_SHIFT) &
+             AVIVO_CRTC_H_POSITION_MASK;
+    avivo_crtc_vblank_lines(crtc, &start, &end);
+    return *line >= start || *line < end;
+}
+
+/*
+ * Number and time (avivo_get_usec() clock) of the last vblank, worked
+ * back from the scanout position: no need to have been looking when
+ * it happened.  Returns FALSE if the crtc is off.
+ */
+Bool
+avivo_crtc_vblank_time(xf86CrtcPtr crtc, CARD32 *frame, unsigned long *usec)
+{
+    DisplayModePtr mode = &crtc->mode;
+    unsigned long now, since;
+    CARD32 before;
+    int line, pixel, lines, start, end;
+
+    if (!avivo_crtc_line_ns(crtc))
+        return FALSE;
+    /* the counter and the position must belong to the same frame */
+    do {
+        before = avivo_crtc_frame_count(crtc);
+        avivo_crtc_get_position(crtc, &line, &pixel);
+        now = avivo_get_usec();
+        *frame = avivo_crtc_frame_count(crtc);
+    } while (*frame != before);
+
+    avivo_crtc_vblank_lines(crtc, &start, &end);
+    lines = line - start;
+    if (lines < 0)
+        lines += mode->VTotal;
+    /* pixels / kHz = ms */
+    since = ((unsigned long)lines * mode->HTotal + pixel) * 1000 /
+            mode->Clock;
+    *usec = now - since;
+    return TRUE;
+}
+
+/* lines from 'from' to 'to', going forward through the frame */
+static int
+avivo_crtc_line_distance(DisplayModePtr mode, int from, int to)
+{
+    int lines = to - from;
+
+    if (lines < 0)
+        lines += mode->VTotal;
+    return lines;
+}
+
+/*
+ * Wait for the crtc to reach the given line.  Sleeps while the line is
+ * far off, spins the last AVIVO_VBLANK_SPIN_USEC, and gives up after
+ * two frames whatever the chip says.  Returns FALSE on timeout or if
+ * the crtc is off.
+ */
+Bool
+avivo_crtc_wait_line(xf86CrtcPtr crtc, int target)
+{
+    struct avivo_crtc_private *avivo_crtc = crtc->driver_private;
+    struct avivo_vblank *vblank = &avivo_crtc->vblank;
+    DisplayModePtr mode = &crtc->mode;
+    unsigned long line_ns = avivo_crtc_line_ns(crtc);
+    unsigned long start, limit, elapsed, remaining;
+    int line, pixel, lines, last;
+    Bool reached = FALSE;
+
+    if (!line_ns || target < 0 || target >= mode->VTotal)
+        return FALSE;
+    vblank->waits++;
+    start = avivo_get_usec();
+    limit = 2 * line_ns * mode->VTotal / 1000 + AVIVO_VBLANK_SPIN_USEC;
+    last = mode->VTotal;
+    for (;;) {
+        avivo_crtc_get_position(crtc, &line, &pixel);
+        lines = avivo_crtc_line_distance(mode, line, target);
+        /* on the line, or just went past it between two reads */
+        if (lines == 0 || lines > last) {
+            reached = TRUE;
+            break;
+        }
+        last = lines;
+        elapsed = avivo_get_usec() - start;
+        if (elapsed > limit) {
+            vblank->timeouts++;
+            xf86DrvMsg(crtc->scrn->scrnIndex, X_WARNING,
+                       "crtc(%d) never reached line %d (at %d)\n",
+                       avivo_crtc->crtc_number, target, line);
+            break;
+        }
+        remaining = lines * line_ns / 1000;
+        if (remaining > 2 * AVIVO_VBLANK_SPIN_USEC) {
+            usleep(remaining - AVIVO_VBLANK_SPIN_USEC);
+            vblank->sleeps++;
+        }
+    }
+
+    elapsed = avivo_get_usec() - start;
+    vblank->total_usec += elapsed;
+    if (elapsed > vblank->max_usec)
+        vblank->max_usec = elapsed;
+    return reached;
+}
+
+Bool
+avivo_crtc_wait_vblank(xf86CrtcPtr crtc)
+{
+    int start, end;
+
+    avivo_crtc_vblank_lines(crtc, &start, &end);
+    return avivo_crtc_wait_line(crtc, start);
+}
+
+void
+avivo_vblank_dump_stats(ScrnInfoPtr screen_info)
+{
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(screen_info);
+    struct avivo_crtc_private *avivo_crtc;
+    struct avivo_vblank *vblank;
+    int i;
+
+    for (i = 0; i < config->num_crtc; i++) {
+        avivo_crtc = config->crtc[i]->driver_private;
+        vblank = &avivo_crtc->vblank;
+        if (!vblank->waits)
+            continue;
+        xf86DrvMsg(screen_info->scrnIndex, X_INFO,
+                   "crtc(%d) line waits: %lu waits, %lu sleeps, "
+                   "%lu timeouts, %lu us total, %lu us max\n",
+                   avivo_crtc->crtc_number, vblank->waits, vblank->sleeps,
+                   vblank->timeouts, vblank->total_usec, vblank->max_usec);
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo VRAM heap.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+
+#include "avivo_vram.h"
+
+void
+avivo_vram_heap_init(struct avivo_vram_heap *heap, unsigned long start,
+                     unsigned long end)
+{
+    memset(heap, 0, sizeof(*heap));
+    heap->start = (start + AVIVO_VRAM_ALIGN - 1) & ~(AVIVO_VRAM_ALIGN - 1);
+    heap->end = end & ~(AVIVO_VRAM_ALIGN - 1);
+    if (heap->end < heap->start)
+        heap->end = heap->start;
+}
+
+/*
+ * First fit.  Returns the offset from the start of VRAM, or 0 (the
+ * front buffer, never handed out) if nothing fits.
+ */
+unsigned long
+avivo_vram_heap_alloc(struct avivo_vram_heap *heap, unsigned long size,
+                      unsigned long align)
+{
+    unsigned long offset, next;
+    int i;
+
+    if (align < AVIVO_VRAM_ALIGN)
+        align = AVIVO_VRAM_ALIGN;
+    size = (size + AVIVO_VRAM_ALIGN - 1) & ~(AVIVO_VRAM_ALIGN - 1);
+    offset = heap->start;
+    for (i = 0; i <= heap->count; i++) {
+        offset = (offset + align - 1) / align * align;
+        next = i < heap->count ? heap->block[i].offset : heap->end;
+        if (offset < next && size <= next - offset)
+            break;
+        if (i < heap->count)
+            offset = heap->block[i].offset + heap->block[i].size;
+    }
+    if (i > heap->count || heap->count == AVIVO_VRAM_MAX_BLOCKS ||
+        !size || !offset) {
+        heap->failures++;
+        return 0;
+    }
+    memmove(&heap->block[i + 1], &heap->block[i],
+            (heap->count - i) * sizeof(heap->block[0]));
+    heap->block[i].offset = offset;
+    heap->block[i].size = size;
+    heap->count++;
+    heap->allocs++;
+    return offset;
+}
+
+/* Returns 0 if no block starts at offset. */
+int
+avivo_vram_heap_free(struct avivo_vram_heap *heap, unsigned long offset)
+{
+    int i;
+
+    for (i = 0; i < heap->count; i++) {
+        if (heap->block[i].offset == offset) {
+            heap->count--;
+            memmove(&heap->block[i], &heap->block[i + 1],
+                    (heap->count - i) * sizeof(heap->block[0]));
+            return 1;
+        }
+    }
+    return 0;
+}
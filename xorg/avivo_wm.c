@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2007 Daniel Stone
+ * Copyright © 2007 Matthew Garrett
+ * Copyright © 2007 Jerome Glisse
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the General Public License is included with the source
+ * distribution of this driver, as COPYING.
+ *
+ * Authors: Daniel Stone <daniel@fooishbar.org>
+ *          Matthew Garrett <mjg59@srcf.ucam.org>
+ *          Jerome Glisse <glisse@freedesktop.org>
+ */
+/*
+ * avivo display priority and line buffer calculator.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "avivo_wm.h"
+#include "radeon_reg.h"
+
+/*
+ * Scanout bandwidth of one head in kB/s: only the active part of each
+ * line is fetched from memory.
+ */
+int
+avivo_wm_head_bandwidth(const struct avivo_wm_head *head)
+{
+    if (head->clock <= 0 || head->htotal <= 0)
+        return 0;
+    return (int)(((long long)head->clock * head->cpp * head->hdisplay) /
+                 head->htotal);
+}
+
+static unsigned int
+avivo_wm_lb_split(const struct avivo_wm_params *params)
+{
+    int w1 = params->head[0].clock > 0 ? params->head[0].hdisplay : 0;
+    int w2 = params->head[1].clock > 0 ? params->head[1].hdisplay : 0;
+
+    if (w1 && !w2)
+        return AVIVO_DC_LB_MEMORY_SPLIT_D1_ONLY;
+    if (!w1 && w2)
+        return AVIVO_DC_LB_MEMORY_SPLIT_D1_1Q_D2_3Q;
+    /* give the wider head the bigger part when it needs it */
+    if (w1 >= 2 * w2 && w2)
+        return AVIVO_DC_LB_MEMORY_SPLIT_D1_3Q_D2_1Q;
+    if (w2 >= 2 * w1 && w1)
+        return AVIVO_DC_LB_MEMORY_SPLIT_D1_1Q_D2_3Q;
+    return AVIVO_DC_LB_MEMORY_SPLIT_D1HALF_D2HALF;
+}
+
+/*
+ * Work out the line buffer split and each crtc's priority mark.  The
+ * mark is how many 16 pixel groups the crtc may drain from its line
+ * buffer before its requests become urgent: the pixels scanned out
+ * while a request is outstanding.  That is the memory latency, plus
+ * one chunk of the other head in front of us, stretched by however
+ * busy memory already is.  Returns 1 if memory keeps up with both
+ * heads, 0 if it doesn't; the priorities are then forced on, which
+ * is the best we can do.
+ *
+ * That is mark set A, used at the memory clock we were given.  Set B
+ * is used when the memory controller runs its other clock, which we
+ * never switch to and can't know, so B keeps requests urgent instead
+ * of guessing a mark for it.
+ */
+int
+avivo_wm_compute(const struct avivo_wm_params *params, struct avivo_wm *wm)
+{
+    int mclk = params->mclk > 0 ? params->mclk : AVIVO_WM_DEFAULT_MCLK;
+    int bus = params->bus_bytes > 0 ? params->bus_bytes : AVIVO_WM_BUS_BYTES;
+    long long latency, mark;
+    int i, fits;
+
+    /* DDR: two transfers per clock */
+    wm->available = (int)((long long)mclk * bus * 2 *
+                          AVIVO_WM_EFFICIENCY / 100);
+    wm->demand = avivo_wm_head_bandwidth(&params->head[0]) +
+                 avivo_wm_head_bandwidth(&params->head[1]);
+    wm->lb_split = avivo_wm_lb_split(params);
+    fits = wm->demand < wm->available;
+
+    for (i = 0; i < 2; i++) {
+        const struct avivo_wm_head *head = &params->head[i];
+
+        if (head->clock <= 0) {
+            wm->latency_ns[i] = 0;
+            wm->priority[i] = AVIVO_CRTC_PRIORITY_OFF;
+            wm->priority_b[i] = AVIVO_CRTC_PRIORITY_OFF;
+            continue;
+        }
+        latency = AVIVO_WM_LATENCY_NS;
+        if (params->head[!i].clock > 0)
+            latency += (long long)AVIVO_WM_CHUNK_BYTES * 1000000 /
+                       wm->available;
+        if (fits)
+            latency = latency * wm->available /
+                      (wm->available - wm->demand);
+        wm->latency_ns[i] = (int)latency;
+
+        /* ns * kHz / 10^6 = pixels, rounded up, plus one group spare */
+        mark = (latency * head->clock + 999999) / 1000000;
+        mark = (mark + AVIVO_WM_MARK_PIXELS - 1) / AVIVO_WM_MARK_PIXELS + 1;
+        if (mark > AVIVO_CRTC_PRIORITY_MARK_MASK)
+            mark = AVIVO_CRTC_PRIORITY_MARK_MASK;
+        wm->priority[i] = (unsigned int)mark;
+        if (!fits)
+            wm->priority[i] |= AVIVO_CRTC_PRIORITY_ALWAYS_ON;
+        wm->priority_b[i] = wm->priority[i] | AVIVO_CRTC_PRIORITY_ALWAYS_ON;
+    }
+    return fits;
+}